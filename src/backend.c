@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+
+/*
+ * libdbus backend
+ */
+
+static int libdbus_connect(Backend *backend, DBusError *error)
+{
+    backend->state = dbus_bus_get(DBUS_BUS_SESSION, error);
+    return backend->state != NULL;
+}
+
+static int libdbus_call_method(Backend *backend, DBusMessage *msg, int timeoutMs, DBusMessage **reply,
+                               DBusError *error)
+{
+    DBusConnection *conn = backend->state;
+
+    if (reply == NULL) {
+        dbus_message_set_no_reply(msg, TRUE);
+        if (!dbus_connection_send(conn, msg, NULL)) {
+            dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, "Could not queue DBus message");
+            return 0;
+        }
+        dbus_connection_flush(conn);
+        return 1;
+    }
+
+    *reply = dbus_connection_send_with_reply_and_block(conn, msg, timeoutMs, error);
+    return *reply != NULL;
+}
+
+static DBusMessage *libdbus_get_property(Backend *backend, const char *destination, const char *path,
+                                         const char *interface, const char *property, int timeoutMs,
+                                         DBusError *error)
+{
+    DBusMessage *msg, *reply = NULL;
+
+    msg = dbus_message_new_method_call(destination, path, DBUS_INTERFACE_PROPERTIES, "Get");
+    if (msg == NULL || !dbus_message_append_args(msg,
+            DBUS_TYPE_STRING, &interface,
+            DBUS_TYPE_STRING, &property,
+            DBUS_TYPE_INVALID)) {
+        if (msg != NULL) {
+            dbus_message_unref(msg);
+        }
+        dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, "DBus message was NULL");
+        return NULL;
+    }
+
+    libdbus_call_method(backend, msg, timeoutMs, &reply, error);
+    dbus_message_unref(msg);
+    return reply;
+}
+
+static int libdbus_subscribe(Backend *backend, const char *rule, DBusError *error)
+{
+    dbus_bus_add_match(backend->state, rule, error);
+    return !dbus_error_is_set(error);
+}
+
+static void libdbus_unsubscribe(Backend *backend, const char *rule)
+{
+    // Not waited for: a late removal only lets a few more signals through
+    dbus_bus_remove_match(backend->state, rule, NULL);
+}
+
+static BackendEvent libdbus_dispatch(Backend *backend, int timeoutMs, DBusMessage **msg)
+{
+    DBusConnection *conn = backend->state;
+
+    // Messages may already be queued, received while waiting for a method reply
+    *msg = dbus_connection_pop_message(conn);
+    if (*msg != NULL) {
+        return BACKEND_MESSAGE;
+    }
+    if (!dbus_connection_read_write(conn, timeoutMs)) {
+        return BACKEND_CLOSED;
+    }
+    *msg = dbus_connection_pop_message(conn);
+    return *msg != NULL ? BACKEND_MESSAGE : BACKEND_IDLE;
+}
+
+static int libdbus_poll_fd(Backend *backend)
+{
+    int fd;
+
+    return dbus_connection_get_unix_fd(backend->state, &fd) ? fd : -1;
+}
+
+static void libdbus_disconnect(Backend *backend)
+{
+    if (backend->state != NULL) {
+        dbus_connection_unref(backend->state);
+        backend->state = NULL;
+    }
+}
+
+const BackendOps libdbus_backend = {
+    "libdbus",
+    libdbus_connect,
+    libdbus_get_property,
+    libdbus_call_method,
+    libdbus_subscribe,
+    libdbus_unsubscribe,
+    libdbus_dispatch,
+    libdbus_poll_fd,
+    libdbus_disconnect
+};
+
+/*
+ * Capture files
+ */
+
+FILE *capture_create(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+
+    if (file != NULL && fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_SIZE, file) != CAPTURE_MAGIC_SIZE) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+int capture_write_record(FILE *file, CaptureKind kind, const char *name, DBusMessage *msg)
+{
+    CaptureRecordHeader header;
+    char *data;
+    int len, written;
+
+    if (!dbus_message_marshal(msg, &data, &len)) {
+        return 0;
+    }
+    header.kind = kind;
+    header.nameLength = (uint32_t)strlen(name);
+    header.dataLength = (uint32_t)len;
+    written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(name, 1, header.nameLength, file) == header.nameLength
+        && fwrite(data, 1, header.dataLength, file) == header.dataLength
+        && fflush(file) == 0;
+    dbus_free(data);
+    return written;
+}
+
+/*
+ * Replay backend
+ */
+
+typedef struct {
+    CaptureKind kind;
+    char *name;
+    DBusMessage *msg;
+    size_t size;
+} ReplayRecord;
+
+typedef struct {
+    ReplayRecord *records;
+    size_t count;
+    size_t nextReply;
+    size_t nextSignal;
+    dbus_uint32_t serial;
+} ReplayState;
+
+static void replay_free(ReplayState *state)
+{
+    for (size_t i = 0; i < state->count; ++i) {
+        free(state->records[i].name);
+        dbus_message_unref(state->records[i].msg);
+    }
+    free(state->records);
+    free(state);
+}
+
+/**
+ * Reads the next record of a capture file
+ *
+ * @return 1 when a record was read, 0 at the end of the file, -1 on malformed data
+ */
+static int replay_read_record(FILE *file, ReplayRecord *record, DBusError *error)
+{
+    CaptureRecordHeader header;
+    char *data;
+    size_t n = fread(&header, 1, sizeof(header), file);
+
+    if (n == 0) {
+        return 0;
+    }
+    if (n != sizeof(header) || header.nameLength > DBUS_MAXIMUM_NAME_LENGTH
+            || header.dataLength > DBUS_MAXIMUM_MESSAGE_LENGTH) {
+        return -1;
+    }
+
+    record->kind = header.kind;
+    record->size = header.dataLength;
+    record->name = malloc(header.nameLength + 1);
+    data = malloc(header.dataLength);
+    if (record->name == NULL || data == NULL
+            || fread(record->name, 1, header.nameLength, file) != header.nameLength
+            || fread(data, 1, header.dataLength, file) != header.dataLength) {
+        free(record->name);
+        free(data);
+        return -1;
+    }
+    record->name[header.nameLength] = '\0';
+
+    record->msg = dbus_message_demarshal(data, (int)header.dataLength, error);
+    free(data);
+    if (record->msg == NULL) {
+        free(record->name);
+        return -1;
+    }
+    return 1;
+}
+
+static int replay_connect(Backend *backend, DBusError *error)
+{
+    ReplayState *state;
+    FILE *file;
+    char magic[CAPTURE_MAGIC_SIZE];
+    size_t capacity = 0;
+    int status;
+
+    file = fopen(backend->source, "rb");
+    if (file == NULL) {
+        dbus_set_error(error, DBUS_ERROR_FILE_NOT_FOUND, "Cannot open capture file %s", backend->source);
+        return 0;
+    }
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+            || memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) != 0) {
+        fclose(file);
+        dbus_set_error(error, DBUS_ERROR_INVALID_FILE_CONTENT, "%s is not a capture file", backend->source);
+        return 0;
+    }
+
+    state = calloc(1, sizeof(ReplayState));
+    if (state == NULL) {
+        fclose(file);
+        dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, "Out of memory");
+        return 0;
+    }
+    while (1) {
+        if (state->count == capacity) {
+            ReplayRecord *grown;
+            capacity = capacity ? capacity * 2 : 16;
+            grown = realloc(state->records, capacity * sizeof(ReplayRecord));
+            if (grown == NULL) {
+                status = -1;
+                break;
+            }
+            state->records = grown;
+        }
+        status = replay_read_record(file, &state->records[state->count], error);
+        if (status <= 0) {
+            break;
+        }
+        state->count++;
+    }
+    fclose(file);
+
+    if (status < 0) {
+        replay_free(state);
+        if (!dbus_error_is_set(error)) {
+            dbus_set_error(error, DBUS_ERROR_INVALID_FILE_CONTENT, "Truncated capture file %s", backend->source);
+        }
+        return 0;
+    }
+    backend->state = state;
+    return 1;
+}
+
+/**
+ * Serves the next recorded reply for `property`, cycling through the capture so that a
+ * benchmark can run any number of times over it
+ */
+DBusMessage *replay_get_property(Backend *backend, const char *destination, const char *path,
+                                 const char *interface, const char *property, int timeoutMs,
+                                 DBusError *error)
+{
+    ReplayState *state = backend->state;
+
+    (void)destination;
+    (void)path;
+    (void)interface;
+    (void)timeoutMs;
+
+    for (size_t n = 0; n < state->count; ++n) {
+        size_t i = (state->nextReply + n) % state->count;
+        ReplayRecord *record = &state->records[i];
+
+        if (record->kind != CAPTURE_PROPERTY_REPLY || strcmp(record->name, property) != 0) {
+            continue;
+        }
+        state->nextReply = i + 1;
+        if (dbus_set_error_from_message(error, record->msg)) {
+            return NULL;
+        }
+        return dbus_message_ref(record->msg);
+    }
+    dbus_set_error(error, DBUS_ERROR_UNKNOWN_PROPERTY, "No recorded reply for %s", property);
+    return NULL;
+}
+
+DBusMessage *replay_record(Backend *backend, size_t index, CaptureKind *kind, const char **name, size_t *size)
+{
+    ReplayState *state = backend->state;
+
+    if (index >= state->count) {
+        return NULL;
+    }
+    *kind = state->records[index].kind;
+    *name = state->records[index].name;
+    *size = state->records[index].size;
+    return state->records[index].msg;
+}
+
+/**
+ * Method calls are accepted and answered with an empty reply: the capture only holds what the
+ * player sent
+ */
+static int replay_call_method(Backend *backend, DBusMessage *msg, int timeoutMs, DBusMessage **reply,
+                              DBusError *error)
+{
+    ReplayState *state = backend->state;
+
+    (void)timeoutMs;
+
+    if (reply == NULL) {
+        return 1;
+    }
+    // As if sent: a reply can only refer to a call with a serial
+    if (dbus_message_get_serial(msg) == 0) {
+        dbus_message_set_serial(msg, ++state->serial);
+    }
+    *reply = dbus_message_new_method_return(msg);
+    if (*reply == NULL) {
+        dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, "DBus message was NULL");
+        return 0;
+    }
+    return 1;
+}
+
+static int replay_subscribe(Backend *backend, const char *rule, DBusError *error)
+{
+    (void)backend;
+    (void)rule;
+    (void)error;
+    return 1;
+}
+
+static void replay_unsubscribe(Backend *backend, const char *rule)
+{
+    (void)backend;
+    (void)rule;
+}
+
+/**
+ * Serves the recorded signals in order, then reports the end of the capture
+ */
+static BackendEvent replay_dispatch(Backend *backend, int timeoutMs, DBusMessage **msg)
+{
+    ReplayState *state = backend->state;
+
+    (void)timeoutMs;
+
+    while (state->nextSignal < state->count) {
+        ReplayRecord *record = &state->records[state->nextSignal++];
+        if (record->kind == CAPTURE_SIGNAL) {
+            *msg = dbus_message_ref(record->msg);
+            return BACKEND_MESSAGE;
+        }
+    }
+    return BACKEND_END;
+}
+
+static int replay_poll_fd(Backend *backend)
+{
+    (void)backend;
+    return -1;
+}
+
+static void replay_disconnect(Backend *backend)
+{
+    if (backend->state != NULL) {
+        replay_free(backend->state);
+        backend->state = NULL;
+    }
+}
+
+const BackendOps replay_backend = {
+    "replay",
+    replay_connect,
+    replay_get_property,
+    replay_call_method,
+    replay_subscribe,
+    replay_unsubscribe,
+    replay_dispatch,
+    replay_poll_fd,
+    replay_disconnect
+};
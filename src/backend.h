@@ -0,0 +1,138 @@
+#ifndef SPOTIFY_DBUS_BACKEND_H
+#define SPOTIFY_DBUS_BACKEND_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <dbus/dbus.h>
+
+/**
+ * Transport backends: every command reaches the player through a Backend, whose operations
+ * exchange plain DBusMessages. The libdbus backend talks to the session bus; the replay backend
+ * serves messages recorded in a capture file, so that decoding can be benchmarked without a bus
+ * or a player.
+ */
+
+/**
+ * Capture file layout: CAPTURE_MAGIC, then records made of a CaptureRecordHeader (in host byte
+ * order), `nameLength` bytes of name and `dataLength` bytes of marshalled message
+ * (dbus_message_marshal, which carries its own byte order).
+ */
+#define CAPTURE_MAGIC "SPDBCAP1"
+#define CAPTURE_MAGIC_SIZE 8
+
+typedef enum {
+    CAPTURE_PROPERTY_REPLY = 1, // Reply to a Properties.Get call, named after the property
+    CAPTURE_SIGNAL = 2          // Signal received from the player, named after its member
+} CaptureKind;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t nameLength;
+    uint32_t dataLength;
+} CaptureRecordHeader;
+
+/**
+ * Creates (or truncates) a capture file & writes its CAPTURE_MAGIC
+ *
+ * @return The file, or NULL with errno set
+ */
+FILE *capture_create(const char *path);
+
+/**
+ * Appends a message to a capture file (see capture_create), flushed right
+ * away so that an interrupted recording still holds every complete record
+ *
+ * @return 1 on success, 0 if the message could not be marshalled or written
+ */
+int capture_write_record(FILE *file, CaptureKind kind, const char *name, DBusMessage *msg);
+
+typedef enum {
+    BACKEND_MESSAGE,    // A message was received
+    BACKEND_IDLE,       // Nothing arrived within the timeout
+    BACKEND_CLOSED,     // The connection is gone
+    BACKEND_END         // The recorded messages ran out (replay): not an error
+} BackendEvent;
+
+typedef struct Backend Backend;
+
+typedef struct {
+    const char *name;
+
+    /**
+     * @return 1 on success, 0 with `error` set otherwise
+     */
+    int (*connect)(Backend *backend, DBusError *error);
+
+    /**
+     * Reads a property with org.freedesktop.DBus.Properties.Get
+     *
+     * @return The reply (to be unreferenced by the caller), or NULL with `error` set
+     */
+    DBusMessage *(*get_property)(Backend *backend, const char *destination, const char *path,
+                                 const char *interface, const char *property, int timeoutMs,
+                                 DBusError *error);
+
+    /**
+     * Sends a method call. With a NULL `reply` the call is flagged NO_REPLY and not waited for;
+     * otherwise the reply is stored in `reply`, to be unreferenced by the caller.
+     *
+     * @return 1 on success, 0 with `error` set otherwise
+     */
+    int (*call_method)(Backend *backend, DBusMessage *msg, int timeoutMs, DBusMessage **reply,
+                       DBusError *error);
+
+    /**
+     * Installs a match rule for the signals to be returned by dispatch
+     *
+     * @return 1 on success, 0 with `error` set otherwise
+     */
+    int (*subscribe)(Backend *backend, const char *rule, DBusError *error);
+
+    /**
+     * Removes a match rule installed by subscribe
+     */
+    void (*unsubscribe)(Backend *backend, const char *rule);
+
+    /**
+     * Waits up to `timeoutMs` (-1 for ever) for the next incoming message
+     *
+     * @param msg   Set to the message on BACKEND_MESSAGE, to be unreferenced by the caller
+     */
+    BackendEvent (*dispatch)(Backend *backend, int timeoutMs, DBusMessage **msg);
+
+    /**
+     * File descriptor that becomes readable when dispatch has something to return, for callers
+     * multiplexing the backend with other fds; -1 if there is none (dispatch then never blocks)
+     */
+    int (*poll_fd)(Backend *backend);
+
+    void (*disconnect)(Backend *backend);
+} BackendOps;
+
+struct Backend {
+    const BackendOps *ops;
+    const char *source;     // Capture file of the replay backend
+    void *state;
+};
+
+extern const BackendOps libdbus_backend;
+extern const BackendOps replay_backend;
+
+/**
+ * The replay backend's get_property, exported so that the indirection cost of going through
+ * BackendOps can be measured against a direct call (`bench backend`)
+ */
+DBusMessage *replay_get_property(Backend *backend, const char *destination, const char *path,
+                                 const char *interface, const char *property, int timeoutMs,
+                                 DBusError *error);
+
+/**
+ * Gives direct access to the messages of a connected replay backend, in capture file order, for
+ * harnesses that feed them to decoders themselves
+ *
+ * @param size  Set to the size of the marshalled message in the capture
+ * @return The message (owned by the backend), or NULL past the last record
+ */
+DBusMessage *replay_record(Backend *backend, size_t index, CaptureKind *kind, const char **name, size_t *size);
+
+#endif
@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "escape.h"
+
+size_t utf8_sequence_length(const unsigned char *s, const unsigned char *end)
+{
+    unsigned char c = s[0];
+    size_t avail = (size_t)(end - s);
+
+    if (c < 0x80) {
+        return 1;
+    }
+    if (c >= 0xc2 && c <= 0xdf) {
+        return avail >= 2 && (s[1] & 0xc0) == 0x80 ? 2 : 0;
+    }
+    if (c >= 0xe0 && c <= 0xef) {
+        // No overlong forms (E0 80..9F) & no UTF-16 surrogates (ED A0..BF)
+        unsigned char lo = c == 0xe0 ? 0xa0 : 0x80, hi = c == 0xed ? 0x9f : 0xbf;
+        return avail >= 3 && s[1] >= lo && s[1] <= hi && (s[2] & 0xc0) == 0x80 ? 3 : 0;
+    }
+    if (c >= 0xf0 && c <= 0xf4) {
+        // No overlong forms (F0 80..8F) & nothing above U+10FFFF (F4 90..BF)
+        unsigned char lo = c == 0xf0 ? 0x90 : 0x80, hi = c == 0xf4 ? 0x8f : 0xbf;
+        return avail >= 4 && s[1] >= lo && s[1] <= hi && (s[2] & 0xc0) == 0x80 && (s[3] & 0xc0) == 0x80 ? 4 : 0;
+    }
+    return 0;
+}
+
+/**
+ * Writes the JSON escape of a byte needing one: '"', '\\' or a control character
+ */
+static char *json_escape_byte(unsigned char c, char *d)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    switch (c) {
+        case '"':  *d++ = '\\'; *d++ = '"'; break;
+        case '\\': *d++ = '\\'; *d++ = '\\'; break;
+        case '\b': *d++ = '\\'; *d++ = 'b'; break;
+        case '\f': *d++ = '\\'; *d++ = 'f'; break;
+        case '\n': *d++ = '\\'; *d++ = 'n'; break;
+        case '\r': *d++ = '\\'; *d++ = 'r'; break;
+        case '\t': *d++ = '\\'; *d++ = 't'; break;
+        default:
+            memcpy(d, "\\u00", 4);
+            d[4] = hex[c >> 4];
+            d[5] = hex[c & 0xf];
+            d += 6;
+            break;
+    }
+    return d;
+}
+
+size_t json_escape(const char *src, size_t len, char *dst)
+{
+    const unsigned char *s = (const unsigned char*)src, *end = s + len;
+    char *d = dst;
+
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+
+    while (end - s >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)s);
+        // Unsigned chunk <= 0x1f: non-ASCII bytes go through unchanged, like ASCII ones
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk),
+                                       _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                                    _mm_cmpeq_epi8(chunk, backslash)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(special);
+
+        if (mask == 0) {
+            _mm_storeu_si128((__m128i*)d, chunk);
+            s += 16;
+            d += 16;
+            continue;
+        }
+        // Copy the span before each special byte of the chunk, then its escape
+        const unsigned char *chunkStart = s;
+        do {
+            const unsigned char *special = chunkStart + __builtin_ctz(mask);
+            memcpy(d, s, (size_t)(special - s));
+            d = json_escape_byte(*special, d + (special - s));
+            s = special + 1;
+            mask &= mask - 1;
+        } while (mask != 0);
+        memcpy(d, s, (size_t)(chunkStart + 16 - s));
+        d += chunkStart + 16 - s;
+        s = chunkStart + 16;
+    }
+#endif
+
+    while (s < end) {
+        if (*s >= 0x20 && *s != '"' && *s != '\\') {
+            *d++ = (char)*s;
+        } else {
+            d = json_escape_byte(*s, d);
+        }
+        s++;
+    }
+    *d = '\0';
+    return (size_t)(d - dst);
+}
+
+/**
+ * Entity replacing each byte in Pango markup (unterminated, zero-padded to 6 bytes so that
+ * they can all be copied the same way), with its length; 0 for the bytes copied as they are
+ */
+static const char pango_entities[256][6] = {
+    ['&'] = "&amp;",
+    ['<'] = "&lt;",
+    ['>'] = "&gt;",
+    ['\''] = "&#39;",
+    ['"'] = "&quot;",
+};
+
+static const unsigned char pango_entity_lengths[256] = {
+    ['&'] = 5,
+    ['<'] = 4,
+    ['>'] = 4,
+    ['\''] = 5,
+    ['"'] = 6,
+};
+
+size_t pango_escape(const char *src, size_t len, char *dst)
+{
+    const unsigned char *s = (const unsigned char*)src, *end = s + len;
+    char *d = dst;
+
+#ifdef __SSE2__
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i apos = _mm_set1_epi8('\'');
+    const __m128i quot = _mm_set1_epi8('"');
+
+    while (end - s >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)s);
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, lt)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, gt), _mm_cmpeq_epi8(chunk, apos)),
+                         _mm_cmpeq_epi8(chunk, quot)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(special);
+
+        if (mask == 0) {
+            _mm_storeu_si128((__m128i*)d, chunk);
+            s += 16;
+            d += 16;
+            continue;
+        }
+        // Copy the span before each special byte of the chunk, then its entity
+        const unsigned char *chunkStart = s;
+        do {
+            const unsigned char *special = chunkStart + __builtin_ctz(mask);
+            memcpy(d, s, (size_t)(special - s));
+            d += special - s;
+            memcpy(d, pango_entities[*special], sizeof(pango_entities[0]));
+            d += pango_entity_lengths[*special];
+            s = special + 1;
+            mask &= mask - 1;
+        } while (mask != 0);
+        memcpy(d, s, (size_t)(chunkStart + 16 - s));
+        d += chunkStart + 16 - s;
+        s = chunkStart + 16;
+    }
+#endif
+
+    // Tail: the tables drive the copy, without a branch per character (entities all start
+    // with '&', plain bytes overwrite it)
+    while (s < end) {
+        size_t entityLength = pango_entity_lengths[*s];
+        memcpy(d, pango_entities[*s], sizeof(pango_entities[0]));
+        d[0] = entityLength != 0 ? '&' : (char)*s;
+        d += entityLength + (entityLength == 0);
+        s++;
+    }
+    *d = '\0';
+    return (size_t)(d - dst);
+}
@@ -0,0 +1,45 @@
+#ifndef SPOTIFY_DBUS_ESCAPE_H
+#define SPOTIFY_DBUS_ESCAPE_H
+
+#include <stddef.h>
+
+/**
+ * Escaping of metadata strings for the structured output formats.
+ *
+ * The kernels scan 16 bytes at a time (SSE2) and copy clean spans as a whole, only dropping to
+ * per-character handling for the bytes that need it. The input is expected to be valid UTF-8:
+ * D-Bus strings are (the bus daemon rejects messages that are not), and multi-byte characters
+ * need no escaping in either format, so they are copied as they are.
+ */
+
+// Worst-case output size (excluding the NUL) for `len` input bytes: "\u001f" is 6 bytes
+#define JSON_ESCAPE_MAX(len) ((len) * 6)
+
+// Same for Pango markup: "&quot;" is 6 bytes
+#define PANGO_ESCAPE_MAX(len) ((len) * 6)
+
+/**
+ * Length of the valid UTF-8 sequence starting at `s` (1 for ASCII)
+ *
+ * @return 0 if the bytes at `s` are not a valid (shortest-form, non-surrogate) sequence
+ */
+size_t utf8_sequence_length(const unsigned char *s, const unsigned char *end);
+
+/**
+ * Escapes UTF-8 text for a JSON string (without the surrounding quotes): '"', '\\' and control
+ * characters are escaped, everything else is copied
+ *
+ * @param dst   At least JSON_ESCAPE_MAX(len) + 1 bytes; the result is NUL-terminated
+ * @return Length of the escaped text
+ */
+size_t json_escape(const char *src, size_t len, char *dst);
+
+/**
+ * Escapes text for Pango markup: &, <, >, ' and " become entities, other bytes are copied
+ *
+ * @param dst   At least PANGO_ESCAPE_MAX(len) + 1 bytes; the result is NUL-terminated
+ * @return Length of the escaped text
+ */
+size_t pango_escape(const char *src, size_t len, char *dst);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef SPOTIFY_DBUS_HASH_H
+#define SPOTIFY_DBUS_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Content fingerprints of decoded metadata, used to tell whether an output would change.
+ *
+ * XXH64 (same algorithm & results as the reference xxHash implementation): 32 bytes per round
+ * over 4 independent lanes, a few GB/s on track-sized strings. It is not a cryptographic hash,
+ * only a cheap way to compare values that were already seen.
+ */
+
+/**
+ * Hashes `len` bytes; chaining calls through `seed` hashes several values in a row (the length
+ * of each is part of its hash, so "a","bc" & "ab","c" differ)
+ */
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+#endif
@@ -0,0 +1,188 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+
+// Largest number of decimals output_double formats by hand (10^18 still fits in a uint64_t)
+#define MAX_DECIMALS 18
+
+// Longest double formatted by format_double (large values go through snprintf)
+#define DOUBLE_TEXT_SIZE 512
+
+static int write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+void output_bytes(Output *out, const char *data, size_t len)
+{
+    while (len > 0) {
+        size_t room = sizeof(out->buf) - out->len;
+        size_t n = len < room ? len : room;
+
+        memcpy(out->buf + out->len, data, n);
+        out->len += n;
+        data += n;
+        len -= n;
+        if (out->len == sizeof(out->buf)) {
+            output_flush(out);
+        }
+    }
+}
+
+void output_str(Output *out, const char *str)
+{
+    output_bytes(out, str, strlen(str));
+}
+
+void output_char(Output *out, char c)
+{
+    if (out->len == sizeof(out->buf)) {
+        output_flush(out);
+    }
+    out->buf[out->len++] = c;
+}
+
+/**
+ * Formats `value` right-aligned at the end of `end`, zero-padded to `minDigits`
+ *
+ * @return Start of the digits
+ */
+static char *format_digits(char *end, uint64_t value, int minDigits)
+{
+    char *p = end;
+
+    do {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+        minDigits--;
+    } while (value != 0 || minDigits > 0);
+    return p;
+}
+
+void output_uint(Output *out, uint64_t value)
+{
+    output_uint_padded(out, value, 0);
+}
+
+void output_int(Output *out, int64_t value)
+{
+    if (value < 0) {
+        output_char(out, '-');
+        output_uint(out, (uint64_t)0 - (uint64_t)value);
+    } else {
+        output_uint(out, (uint64_t)value);
+    }
+}
+
+/**
+ * Formats a double like printf's "%.*f" into `text`
+ *
+ * @return Length of the text
+ */
+static size_t format_double(char text[DOUBLE_TEXT_SIZE], double value, int decimals)
+{
+    uint64_t scale = 1, whole, fraction;
+    double scaled;
+    char *p = text, *start;
+    char digits[20];
+
+    if (decimals < 0 || decimals > MAX_DECIMALS || !isfinite(value) || value >= 1e18 || value <= -1e18) {
+        int len = snprintf(text, DOUBLE_TEXT_SIZE, "%.*f", decimals, value);
+        return len < 0 ? 0 : (size_t)len < DOUBLE_TEXT_SIZE ? (size_t)len : DOUBLE_TEXT_SIZE - 1;
+    }
+
+    if (signbit(value)) {
+        *p++ = '-';
+        value = -value;
+    }
+    for (int i = 0; i < decimals; ++i) {
+        scale *= 10;
+    }
+    whole = (uint64_t)value;
+    // Round half to even, as printf does for exactly representable ties (the last digit is the
+    // whole part's without decimals)
+    scaled = (value - (double)whole) * (double)scale;
+    fraction = (uint64_t)scaled;
+    if (scaled - (double)fraction > 0.5
+            || (scaled - (double)fraction == 0.5 && ((decimals > 0 ? fraction : whole) & 1) != 0)) {
+        fraction++;
+    }
+    if (fraction >= scale) {
+        whole++;
+        fraction -= scale;
+    }
+
+    start = format_digits(digits + sizeof(digits), whole, 1);
+    memcpy(p, start, (size_t)(digits + sizeof(digits) - start));
+    p += digits + sizeof(digits) - start;
+    if (decimals > 0) {
+        *p++ = '.';
+        format_digits(p + decimals, fraction, decimals);
+        p += decimals;
+    }
+    return (size_t)(p - text);
+}
+
+void output_double(Output *out, double value, int decimals)
+{
+    output_double_padded(out, value, decimals, 0);
+}
+
+void output_padded(Output *out, const char *data, size_t len, int width)
+{
+    size_t columns = (size_t)(width < 0 ? -width : width);
+    size_t padding = len < columns ? columns - len : 0;
+
+    if (width > 0) {
+        for (; padding > 0; padding--) {
+            output_char(out, ' ');
+        }
+    }
+    output_bytes(out, data, len);
+    for (; padding > 0; padding--) {
+        output_char(out, ' ');
+    }
+}
+
+void output_uint_padded(Output *out, uint64_t value, int width)
+{
+    char digits[20];
+    char *start = format_digits(digits + sizeof(digits), value, 1);
+
+    output_padded(out, start, (size_t)(digits + sizeof(digits) - start), width);
+}
+
+void output_double_padded(Output *out, double value, int decimals, int width)
+{
+    char text[DOUBLE_TEXT_SIZE];
+
+    output_padded(out, text, format_double(text, value, decimals), width);
+}
+
+int output_flush(Output *out)
+{
+    int status;
+
+    if (out->len == 0) {
+        return 0;
+    }
+    fflush(stdout);
+    status = write_all(out->fd, out->buf, out->len);
+    out->len = 0;
+    return status;
+}
@@ -0,0 +1,56 @@
+#ifndef SPOTIFY_DBUS_OUTPUT_H
+#define SPOTIFY_DBUS_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Buffered output writer: commands render their whole output into one preallocated buffer,
+ * with hand-rolled number formatting, and emit it with a single write(2) on output_flush.
+ * The buffer is only written out earlier if it fills up.
+ */
+
+#define OUTPUT_BUFFER_SIZE 65536
+
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[OUTPUT_BUFFER_SIZE];
+} Output;
+
+void output_bytes(Output *out, const char *data, size_t len);
+
+void output_str(Output *out, const char *str);
+
+void output_char(Output *out, char c);
+
+void output_int(Output *out, int64_t value);
+
+void output_uint(Output *out, uint64_t value);
+
+/**
+ * Formats a double like printf's "%.*f"
+ */
+void output_double(Output *out, double value, int decimals);
+
+/**
+ * Writes `len` bytes padded with spaces to `width` columns (counted in bytes): right-aligned like
+ * printf's "%*s", or left-aligned like "%-*s" with a negative width
+ */
+void output_padded(Output *out, const char *data, size_t len, int width);
+
+/**
+ * Same as output_uint & output_double, padded like output_padded ("%*llu", "%*.*f")
+ */
+void output_uint_padded(Output *out, uint64_t value, int width);
+
+void output_double_padded(Output *out, double value, int decimals, int width);
+
+/**
+ * Writes out the buffered output (after anything still pending in stdio's stdout)
+ *
+ * @return 0 on success, -1 if the write failed (the output is dropped either way)
+ */
+int output_flush(Output *out);
+
+#endif
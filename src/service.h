@@ -0,0 +1,27 @@
+#ifndef SPOTIFY_DBUS_SERVICE_H
+#define SPOTIFY_DBUS_SERVICE_H
+
+/**
+ * Protocol between `spotify-dbus serve` and spotify-dbus-client, over a Unix stream socket
+ * (SERVICE_SOCKET_NAME in the runtime directory, as for the track cache).
+ *
+ * The client sends a single request line ("track", "field KEY", "play", "next" or "prev") and
+ * the service answers with one status byte (the exit code to use) followed by the text to
+ * print (on stdout for status 0, stderr otherwise), then closes the connection.
+ */
+
+#define SERVICE_SOCKET_NAME "sock"
+
+// Per-user runtime directory (mode 0700) used when XDG_RUNTIME_DIR is not set, from the uid
+#define RUNTIME_FALLBACK_DIR "/tmp/spotify-dbus-%u"
+#define SERVICE_REQUEST_SIZE 256
+// Large enough for a --json track block, the longest reply
+#define SERVICE_REPLY_SIZE 32768
+
+// Time a client has to send its request line before the service drops it
+#define SERVICE_REQUEST_TIMEOUT_MS 250
+
+// Exit code of the client when no service is listening
+#define SERVICE_UNAVAILABLE 8
+
+#endif
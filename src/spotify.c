@@ -1,28 +1,114 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <malloc.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include <dbus/dbus.h>
 
+#include "backend.h"
+#include "escape.h"
+#include "hash.h"
+#include "output.h"
+#include "service.h"
+#include "width.h"
+#include "wire.h"
+
 
 #define DEBUG 0
-#define MAXSIZE 100
+#define MAXSIZE 256
+#define METADATA_ARENA_SIZE 16384
+#define MAX_KEY_LENGTH 256
+#define MAX_DECODE_DEPTH 16
+#define DEFAULT_TIMEOUT_MS 500
+#define TRACK_CACHE_SIZE 1024
+#define STALE_MARKER " (stale)"
+#define DEFAULT_COALESCE_WINDOW_MS 40
+#define DEFAULT_SETTLE_WINDOW_MS 15
+#define SEEK_UNIT_US 1000000.0
+#define DEFAULT_BENCH_RUNS 100
+#define PLAYBACK_STATUS_SIZE 16
+#define MARQUEE_GAP "   "
+#define DEFAULT_MARQUEE_HZ 4.0
+
+// Deadline (in milliseconds) applied to every D-Bus method call, set with -t/--timeout
+static int call_timeout_ms = DEFAULT_TIMEOUT_MS;
+
+// Whether `track` may use the lightweight wire client (disabled with --libdbus)
+static int use_wire_transport = 1;
+
+// Whether control commands wait for Spotify's reply (--confirm) or fire and forget
+static int confirm_calls = 0;
+
+typedef enum {
+    FORMAT_TEXT,    // "ARTIST - TITLE"
+    FORMAT_JSON,    // i3bar/waybar JSON block
+    FORMAT_PANGO    // "ARTIST - TITLE" escaped for Pango markup (i3blocks markup=pango)
+} OutputFormat;
+
+// How `track` & `follow` render the current track, set with --json or --pango
+static OutputFormat output_format = FORMAT_TEXT;
+
+// Display width (in columns) `track` & `follow` lines are cut to with an ellipsis, 0 for none
+static size_t max_width = 0;
+
+// Window (in milliseconds) over which bursts of relative seek/volume commands are merged
+static int coalesce_window_ms = DEFAULT_COALESCE_WINDOW_MS;
+
+// Window (in milliseconds) the resident commands let a burst of player signals settle over
+static int settle_window_ms = DEFAULT_SETTLE_WINDOW_MS;
+
+// Unique bus name (":1.xx") of Spotify once resolved by resolve_player, empty otherwise
+static char player_owner[DBUS_MAXIMUM_NAME_LENGTH + 1];
+static int watching_player_owner = 0;
+
+// Buffered stdout, written out with a single write(2) per command (or per `follow` line)
+static Output stdout_output = { STDOUT_FILENO, 0, { 0 } };
 
 typedef enum {
     NEXT,
     PREV
 } NextOrPrev;
 
+/**
+ * A single node of the flattened metadata tree.
+ *
+ * Every decoded value gets its own item, addressed by a path key built from the metadata key
+ * it was found under: array and struct members are suffixed with "[index]", dict entries with
+ * ".dictkey" (e.g. "xesam:artist[1]"). Containers also get an item (with a NULL value) so that
+ * the tree structure can be walked through the `parent`/`depth` fields.
+ * Keys and values are stored in the owning MetadataArray arena.
+ */
 typedef struct {
     char *key;
     int dbus_type;
     void *value;
+    size_t size;
+    int32_t parent;
+    uint32_t depth;
 } MetadataItem;
 
 typedef struct {
     MetadataItem meta[MAXSIZE];
     uint32_t curIndex;
+    size_t arenaUsed;
+    char arena[METADATA_ARENA_SIZE];
 } MetadataArray;
 
 typedef enum {
@@ -31,55 +117,432 @@ typedef enum {
     WRONG_TYPE
 } GetMetadataResult;
 
+/**
+ * Compile-time schema of the MPRIS metadata fields decoded into a TrackInfo:
+ * X(field name, metadata key, field kind)
+ */
+#define TRACK_SCHEMA(X) \
+    X(artist,      "xesam:artist",      FIELD_FIRST_STRING) \
+    X(title,       "xesam:title",       FIELD_STRING) \
+    X(album,       "xesam:album",       FIELD_STRING) \
+    X(length_us,   "mpris:length",      FIELD_INT64) \
+    X(trackid,     "mpris:trackid",     FIELD_STRING) \
+    X(artUrl,      "mpris:artUrl",      FIELD_STRING) \
+    X(trackNumber, "xesam:trackNumber", FIELD_INT32)
+
+#define TRACK_STRING_SIZE 512
+
+/**
+ * How a metadata value is stored in its TrackInfo field:
+ *  - FIELD_STRING: string or object path, copied into a char[TRACK_STRING_SIZE]
+ *  - FIELD_FIRST_STRING: first element of a string array (e.g. the main artist), same storage
+ *  - FIELD_INT64 / FIELD_INT32: any D-Bus integer type, converted to int64_t / int32_t
+ */
+typedef enum {
+    FIELD_STRING,
+    FIELD_FIRST_STRING,
+    FIELD_INT64,
+    FIELD_INT32
+} TrackFieldKind;
+
+#define FIELD_STRING_DECL(name)         char name[TRACK_STRING_SIZE]
+#define FIELD_FIRST_STRING_DECL(name)   char name[TRACK_STRING_SIZE]
+#define FIELD_INT64_DECL(name)          int64_t name
+#define FIELD_INT32_DECL(name)          int32_t name
+
+#define TRACK_FIELD_ENUM(name, key, kind)   TRACK_FIELD_##name,
+#define TRACK_FIELD_DECL(name, key, kind)   kind##_DECL(name);
+
+typedef enum {
+    TRACK_SCHEMA(TRACK_FIELD_ENUM)
+    TRACK_FIELD_COUNT
+} TrackField;
+
+/**
+ * Typed view of the current track, filled in a single pass over the metadata dict by
+ * get_track_info. Fields are accessed directly (e.g. `info.title`); `present` has bit
+ * (1 << TRACK_FIELD_<name>) set for every field the player provided.
+ */
+typedef struct {
+    uint32_t present;
+    TRACK_SCHEMA(TRACK_FIELD_DECL)
+} TrackInfo;
+
+#define TRACK_HAS(info, name) (((info)->present & (1u << TRACK_FIELD_##name)) != 0)
+
+/**
+ * Outcome of a D-Bus exchange with Spotify, returned by get_dbus_metadata & the command_*
+ * functions. The values double as the process exit codes.
+ */
+typedef enum {
+    SPOTIFY_OK = 0,
+    SPOTIFY_NOT_RUNNING,
+    SPOTIFY_TIMEOUT,
+    SPOTIFY_NO_MEMORY,
+    SPOTIFY_BAD_REPLY,
+    SPOTIFY_NO_METADATA,
+    SPOTIFY_DBUS_ERROR,
+    SPOTIFY_BAD_ARGUMENT
+} SpotifyError;
+
+#define SPOTIFY_BUS_NAME "org.mpris.MediaPlayer2.spotify"
+#define MPRIS_PATH "/org/mpris/MediaPlayer2"
+#define MPRIS_PLAYER_INTERFACE "org.mpris.MediaPlayer2.Player"
+#define SPOTIFY_ERROR_BAD_REPLY "org.mpris.MediaPlayer2.spotify.Error.BadReply"
+#define NAME_OWNER_CHANGED_RULE "type='signal',sender='org.freedesktop.DBus',interface='org.freedesktop.DBus'," \
+    "member='NameOwnerChanged',arg0='" SPOTIFY_BUS_NAME "'"
+// Followed by the sender: the unique name of Spotify, so that other MPRIS players never wake us up
+#define PLAYER_PROPERTIES_CHANGED_RULE "type='signal',path='" MPRIS_PATH "'," \
+    "interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',arg0='" MPRIS_PLAYER_INTERFACE "'," \
+    "sender="
+#define PLAYER_RULE_SIZE (sizeof(PLAYER_PROPERTIES_CHANGED_RULE) + DBUS_MAXIMUM_NAME_LENGTH + 2)
+
+// Fields of a PlayerState with a generation: the TrackFields, then the PlaybackStatus
+#define PLAYER_STATUS_FIELD TRACK_FIELD_COUNT
+#define PLAYER_FIELD_COUNT (TRACK_FIELD_COUNT + 1)
+#define PLAYER_FIELD_BIT(field) (1u << (field))
+
+/**
+ * State kept by long-running commands. It survives Spotify restarts: when Spotify goes away
+ * the last known metadata is kept, and it is refreshed as soon as Spotify owns its bus name again.
+ *
+ * The track is updated in place from PropertiesChanged deltas (see apply_track_entries). Every
+ * change bumps `generation`, & fieldGeneration records the generation of each field's last
+ * change, so that consumers can tell which fields changed since they last rendered.
+ */
+typedef struct {
+    Backend *backend;
+    int running;
+    int hasTrack;
+    TrackInfo track;
+    int wantStatus;                     // Whether `status` is kept up to date (FORMAT_JSON, marquee)
+    char status[PLAYBACK_STATUS_SIZE];  // PlaybackStatus
+    uint64_t generation;
+    uint64_t fieldGeneration[PLAYER_FIELD_COUNT];
+    char subscribedRule[PLAYER_RULE_SIZE];  // PropertiesChanged rule installed for the current owner
+} PlayerState;
+
+/**
+ * Wakeups of the resident commands for bus messages, written to stderr on SIGUSR1
+ */
+typedef struct {
+    uint64_t wakeups;       // Messages received
+    uint64_t updates;       // PropertiesChanged signals applied to the player state
+    uint64_t skipped;       // PropertiesChanged signals rejected by player_properties_changed
+    uint64_t emitted;       // Player state changes that were rendered & written
+    uint64_t unchanged;     // Player state changes that left the output fingerprint as is
+} SignalStats;
+
+static SignalStats signal_stats;
+
+/**
+ * Allocation counters, see mem_alloc
+ */
+typedef struct {
+    uint64_t allocs;
+    uint64_t bytes;
+    int64_t live;
+    int64_t peak;
+} AllocStats;
+
+#ifdef ALLOC_STATS
+/*
+ * Allocation accounting build (`make alloc-stats`): `own_allocs` counts the allocations made
+ * through mem_alloc/mem_strdup, while `all_allocs` counts every heap allocation of the process,
+ * libdbus' included, by interposing the libc malloc family. The aligned allocators are
+ * interposed too, as their blocks are released through free like the others.
+ */
+static AllocStats own_allocs, all_allocs;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+
+static void account_alloc(AllocStats *stats, void *ptr)
+{
+    if (ptr != NULL) {
+        size_t size = malloc_usable_size(ptr);
+        stats->allocs++;
+        stats->bytes += size;
+        stats->live += (int64_t)size;
+        if (stats->live > stats->peak) {
+            stats->peak = stats->live;
+        }
+    }
+}
+
+static void account_free(AllocStats *stats, void *ptr)
+{
+    if (ptr != NULL) {
+        stats->live -= (int64_t)malloc_usable_size(ptr);
+    }
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    account_alloc(&all_allocs, ptr);
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *ptr = __libc_calloc(count, size);
+    account_alloc(&all_allocs, ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    account_free(&all_allocs, ptr);
+    ptr = __libc_realloc(ptr, size);
+    account_alloc(&all_allocs, ptr);
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    account_free(&all_allocs, ptr);
+    __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *ptr = __libc_memalign(alignment, size);
+    account_alloc(&all_allocs, ptr);
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size)
+{
+    void *ptr;
+
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    ptr = memalign(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+void *valloc(size_t size)
+{
+    void *ptr = __libc_valloc(size);
+    account_alloc(&all_allocs, ptr);
+    return ptr;
+}
+
+void *pvalloc(size_t size)
+{
+    void *ptr = __libc_pvalloc(size);
+    account_alloc(&all_allocs, ptr);
+    return ptr;
+}
+#endif
+
+/**
+ * Allocator used for every heap allocation made by spotify-dbus itself
+ *
+ * In regular builds it is plain malloc; in `make alloc-stats` builds the allocations are
+ * counted, see alloc_stats_report.
+ */
+void *mem_alloc(size_t size)
+{
+    void *ptr = malloc(size);
+#ifdef ALLOC_STATS
+    account_alloc(&own_allocs, ptr);
+#endif
+    return ptr;
+}
+
+char *mem_strdup(const char *str)
+{
+    size_t size = strlen(str) + 1;
+    char *copy = mem_alloc(size);
+
+    if (copy != NULL) {
+        memcpy(copy, str, size);
+    }
+    return copy;
+}
+
+void mem_free(void *ptr)
+{
+#ifdef ALLOC_STATS
+    account_free(&own_allocs, ptr);
+#endif
+    free(ptr);
+}
+
+/**
+ * Starts a new accounting period: counters are zeroed & peaks restart from the live bytes
+ */
+void alloc_stats_begin()
+{
+#ifdef ALLOC_STATS
+    own_allocs.allocs = own_allocs.bytes = 0;
+    own_allocs.peak = own_allocs.live;
+    all_allocs.allocs = all_allocs.bytes = 0;
+    all_allocs.peak = all_allocs.live;
+#endif
+}
+
+/**
+ * Prints the allocations of the current accounting period on stderr (alloc-stats builds only)
+ */
+void alloc_stats_report(const char *label)
+{
+#ifdef ALLOC_STATS
+    AllocStats own = own_allocs, all = all_allocs;
+
+    fprintf(stderr, "[alloc] %s: spotify-dbus %" PRIu64 " allocs, %" PRIu64 " bytes, peak live %" PRId64
+            " | process (libdbus & libc included) %" PRIu64 " allocs, %" PRIu64 " bytes, peak live %" PRId64 "\n",
+            label, own.allocs, own.bytes, own.peak, all.allocs, all.bytes, all.peak);
+#else
+    (void)label;
+#endif
+}
+
 /**
  * Initialize a MetadataArray
  */
 void init_metadata_array(MetadataArray *arr)
 {
     arr->curIndex = 0;
+    arr->arenaUsed = 0;
 }
 
 /**
- * Free all the dynamically-allocated members in a MetadataArray
+ * Release all the items of a MetadataArray. Everything lives in the array arena, so this only
+ * resets it; the array can be reused right away.
  */
 void free_metadata_array(MetadataArray *arr)
 {
-    for (uint32_t i = 0; i < arr->curIndex; ++i) {
-        free(arr->meta[i].key);
-        free(arr->meta[i].value);
+    init_metadata_array(arr);
+}
+
+/**
+ * Copies a MetadataArray, pointing the copied items at the destination arena
+ */
+void copy_metadata_array(MetadataArray *dst, const MetadataArray *src)
+{
+    dst->curIndex = src->curIndex;
+    dst->arenaUsed = src->arenaUsed;
+    memcpy(dst->arena, src->arena, src->arenaUsed);
+    for (uint32_t i = 0; i < src->curIndex; ++i) {
+        dst->meta[i] = src->meta[i];
+        dst->meta[i].key = dst->arena + (src->meta[i].key - src->arena);
+        if (src->meta[i].value != NULL) {
+            dst->meta[i].value = dst->arena + ((const char*)src->meta[i].value - src->arena);
+        }
+    }
+}
+
+/**
+ * Reserve `size` bytes (8-byte aligned) from the MetadataArray arena
+ *
+ * @return Pointer to the reserved bytes, or NULL if the arena is exhausted
+ */
+static void *arena_alloc(MetadataArray *arr, size_t size)
+{
+    size_t offset = (arr->arenaUsed + 7) & ~(size_t)7;
+
+    if (offset > METADATA_ARENA_SIZE || size > METADATA_ARENA_SIZE - offset) {
+        return NULL;
+    }
+    arr->arenaUsed = offset + size;
+    return arr->arena + offset;
+}
+
+/**
+ * Size in bytes of a fixed-size D-Bus basic type, or 0 for strings, containers & unknown types
+ */
+static size_t fixed_type_size(int dbus_type)
+{
+    switch (dbus_type) {
+        case DBUS_TYPE_BYTE:
+            return sizeof(uint8_t);
+        case DBUS_TYPE_INT16:
+        case DBUS_TYPE_UINT16:
+            return sizeof(int16_t);
+        case DBUS_TYPE_BOOLEAN:
+            return sizeof(dbus_bool_t);
+        case DBUS_TYPE_INT32:
+        case DBUS_TYPE_UINT32:
+            return sizeof(int32_t);
+        case DBUS_TYPE_INT64:
+        case DBUS_TYPE_UINT64:
+            return sizeof(int64_t);
+        case DBUS_TYPE_DOUBLE:
+            return sizeof(double);
+        default:
+            return 0;
     }
 }
 
+static int is_string_type(int dbus_type)
+{
+    return dbus_type == DBUS_TYPE_STRING
+        || dbus_type == DBUS_TYPE_OBJECT_PATH
+        || dbus_type == DBUS_TYPE_SIGNATURE;
+}
+
 /**
  * Append a new metadata item to a MetadataArray
  *
  * @param arr           Pointer to the MetadataArray the new item will be appended to
- * @param key           The metadata item key
+ * @param key           The metadata item (path) key
  * @param dbus_type     Integer representing the metadata value type
- * @param value         Pointer to the metadata value (its actual type depending on dbus_type)
+ * @param value         Pointer to the metadata value (its actual type depending on dbus_type),
+ *                      NULL for container items
  * @param size          The value size in bytes
+ * @param parent        Index of the enclosing container item, -1 for top-level items
+ * @param depth         Nesting depth of the item (0 for top-level items)
+ *
+ * @return Index of the new item, or -1 if it could not be stored
  */
-void insert_metadata(MetadataArray *arr, const char *key, int dbus_type, const void *value, size_t size)
+int32_t insert_metadata(MetadataArray *arr, const char *key, int dbus_type, const void *value,
+                        size_t size, int32_t parent, uint32_t depth)
 {
     if (arr->curIndex >= MAXSIZE) {
         fprintf(stderr, "ERROR: metadata array is full\n");
-        return;
+        return -1;
+    }
+
+    size_t keySize = strlen(key) + 1;
+    size_t valueSize = is_string_type(dbus_type) ? strlen((const char*)value) + 1 : size;
+    char *keyCopy = arena_alloc(arr, keySize);
+    void *valueCopy = (value != NULL) ? arena_alloc(arr, valueSize) : NULL;
+
+    if (keyCopy == NULL || (value != NULL && valueCopy == NULL)) {
+        fprintf(stderr, "ERROR: metadata arena is full\n");
+        return -1;
     }
 
     MetadataItem *m = &arr->meta[arr->curIndex];
-    m->key = strdup(key);
+    memcpy(keyCopy, key, keySize);
+    m->key = keyCopy;
     m->dbus_type = dbus_type;
-    if (dbus_type == DBUS_TYPE_STRING) {
-        m->value = strdup((char*)value);
-    } else {
-        m->value = malloc(size);
-        if (m->value != NULL) {
-            memcpy(m->value, value, size);
-        } else {
-            fprintf(stderr, "ERROR: could not allocate memory for metadata item value\n");
-        }
+    m->value = valueCopy;
+    m->size = valueSize;
+    m->parent = parent;
+    m->depth = depth;
+    if (value != NULL) {
+        memcpy(valueCopy, value, valueSize);
     }
-    arr->curIndex++;
+    return (int32_t)arr->curIndex++;
 }
 
 /**
@@ -89,8 +552,12 @@ void insert_metadata(MetadataArray *arr, const char *key, int dbus_type, const v
  * and dbus_type. If a matching item is found, its value is copied to the location pointed to by
  * outValue. The function ensures type safety by matching the dbus_type of the requested key
  * with the type provided by the caller. If the types do not match, or if the key is not found,
- * appropriate status codes are returned. For string values, the function allocates memory for
- * a duplicate of the string, which the caller is responsible for freeing.
+ * appropriate status codes are returned. For string values (strings, object paths & signatures),
+ * the function allocates memory for a duplicate of the string, which the caller is responsible
+ * for freeing with mem_free.
+ *
+ * Nested values are addressed by their path key, e.g. "xesam:artist[0]" for the first artist.
+ * Container items themselves carry no value and are always reported as VALUE_NOT_FOUND.
  *
  * Note: The caller must ensure that outValue points to a memory location that is suitable for
  * the type of data being requested. For instance, if dbus_type is DBUS_TYPE_INT32, outValue
@@ -115,18 +582,15 @@ GetMetadataResult get_value(MetadataArray *arr, const char *key, int dbus_type,
             if (arr->meta[i].dbus_type != dbus_type) {
                 return WRONG_TYPE;
             }
-            switch (dbus_type) {
-                case DBUS_TYPE_INT32:
-                    *((int32_t*)outValue) = *((int32_t*)arr->meta[i].value);
-                    break;
-                case DBUS_TYPE_STRING:
-                    *((char**)outValue) = strdup((char*)arr->meta[i].value);
-                    break;
-                case DBUS_TYPE_UINT64:
-                    *((uint64_t*)outValue) = *((uint64_t*)arr->meta[i].value);
-                    break;
-                default:
-                    return VALUE_NOT_FOUND;
+            if (arr->meta[i].value == NULL) {
+                return VALUE_NOT_FOUND;
+            }
+            if (is_string_type(dbus_type)) {
+                *((char**)outValue) = mem_strdup((char*)arr->meta[i].value);
+            } else if (fixed_type_size(dbus_type) > 0) {
+                memcpy(outValue, arr->meta[i].value, fixed_type_size(dbus_type));
+            } else {
+                return VALUE_NOT_FOUND;
             }
             return VALUE_FOUND;
         }
@@ -135,294 +599,3409 @@ GetMetadataResult get_value(MetadataArray *arr, const char *key, int dbus_type,
 }
 
 /**
- * Prints all key/value pairs in a MetadataArray to stdout
+ * Renders all key/value pairs in a MetadataArray into `out`
  */
-void print_metadata_array(MetadataArray arr)
+void print_metadata_array(const MetadataArray *arr, Output *out)
 {
-    MetadataItem *tmp;
-    for (uint32_t i = 0; i < arr.curIndex; ++i) {
-        tmp = &arr.meta[i];
-        printf("Metadata item %d:\n\tdbus_type = %d\n\tkey = %s\n\tvalue = ", i, tmp->dbus_type, tmp->key);
+    const MetadataItem *tmp;
+    for (uint32_t i = 0; i < arr->curIndex; ++i) {
+        tmp = &arr->meta[i];
+        output_str(out, "Metadata item ");
+        output_uint(out, i);
+        output_str(out, ":\n\tdbus_type = ");
+        output_int(out, tmp->dbus_type);
+        output_str(out, "\n\tkey = ");
+        output_str(out, tmp->key);
+        output_str(out, "\n\tvalue = ");
         switch (tmp->dbus_type) {
             case DBUS_TYPE_STRING:
-                printf("%s\n", (char*)tmp->value);
+            case DBUS_TYPE_OBJECT_PATH:
+            case DBUS_TYPE_SIGNATURE:
+                output_str(out, (char*)tmp->value);
+                break;
+            case DBUS_TYPE_BYTE:
+                output_uint(out, *((uint8_t*)tmp->value));
+                break;
+            case DBUS_TYPE_BOOLEAN:
+                output_str(out, *((dbus_bool_t*)tmp->value) ? "true" : "false");
+                break;
+            case DBUS_TYPE_INT16:
+                output_int(out, *((int16_t*)tmp->value));
+                break;
+            case DBUS_TYPE_UINT16:
+                output_uint(out, *((uint16_t*)tmp->value));
                 break;
             case DBUS_TYPE_INT32:
-                printf("%d\n", *((int32_t*)tmp->value));
+                output_int(out, *((int32_t*)tmp->value));
+                break;
+            case DBUS_TYPE_UINT32:
+                output_uint(out, *((uint32_t*)tmp->value));
+                break;
+            case DBUS_TYPE_INT64:
+                output_int(out, *((int64_t*)tmp->value));
                 break;
             case DBUS_TYPE_UINT64:
-                printf("%" PRIu64 "\n", *((uint64_t*)tmp->value));
+                output_uint(out, *((uint64_t*)tmp->value));
                 break;
             case DBUS_TYPE_DOUBLE:
-                printf("%f\n", *((double*)tmp->value));
+                output_double(out, *((double*)tmp->value), 6);
+                break;
+            case DBUS_TYPE_ARRAY:
+            case DBUS_TYPE_STRUCT:
+                output_str(out, "(container)");
                 break;
             default:
-                printf("Unsupported type\n");
+                output_str(out, "Unsupported type");
                 break;
         }
+        output_char(out, '\n');
     }
 }
 
-void check_error(DBusError *error)
+/**
+ * Maps a (set) DBusError onto a SpotifyError, without freeing it
+ */
+SpotifyError classify_error(const DBusError *error)
 {
-    if (dbus_error_is_set(error)) {
-        if (strcmp(error->name, "org.freedesktop.DBus.Error.ServiceUnknown") == 0) {
-            fprintf(stderr, "ERROR: is Spotify running?\n");
-        } else {
-            fprintf(stderr, "ERROR: %s\n", error->message);
-        }
-        dbus_error_free(error);
-        exit(1);
+    if (!dbus_error_is_set(error)) {
+        return SPOTIFY_OK;
+    }
+    if (dbus_error_has_name(error, DBUS_ERROR_SERVICE_UNKNOWN)
+            || dbus_error_has_name(error, DBUS_ERROR_NAME_HAS_NO_OWNER)) {
+        return SPOTIFY_NOT_RUNNING;
+    }
+    if (dbus_error_has_name(error, DBUS_ERROR_NO_REPLY)
+            || dbus_error_has_name(error, DBUS_ERROR_TIMEOUT)
+            || dbus_error_has_name(error, DBUS_ERROR_TIMED_OUT)) {
+        return SPOTIFY_TIMEOUT;
     }
+    if (dbus_error_has_name(error, DBUS_ERROR_NO_MEMORY)) {
+        return SPOTIFY_NO_MEMORY;
+    }
+    if (dbus_error_has_name(error, SPOTIFY_ERROR_BAD_REPLY)) {
+        return SPOTIFY_BAD_REPLY;
+    }
+    return SPOTIFY_DBUS_ERROR;
 }
 
 /**
- * Processes a DBusMessageIter and adds the key/values encountered into a MetadataArray
+ * Reports a DBusError on stderr and frees it
+ *
+ * @return The SpotifyError the DBusError maps to (SPOTIFY_OK if it was not set)
  */
-void process_variant(DBusMessageIter *variant, const char *key, MetadataArray *meta)
+SpotifyError check_error(DBusError *error)
 {
-    int varType = dbus_message_iter_get_arg_type(variant);
-
-    int32_t ui32Val;
-    uint64_t ui64Val;
-    double dblVal;
-    char *strVal;
-    void *output = NULL;
-    size_t outputSize;
-    DBusMessageIter arr;
+    SpotifyError err = classify_error(error);
 
-    switch (varType) {
-        case DBUS_TYPE_STRING:
-            dbus_message_iter_get_basic(variant, &strVal);
-            if (DEBUG) printf("\tString: %s\n", strVal);
-            output = strVal;
-            outputSize = sizeof(char) * strlen(strVal);
-            break;
-        case DBUS_TYPE_INT32:
-            dbus_message_iter_get_basic(variant, &ui32Val);
-            if (DEBUG) printf("\tInt32: %d\n", ui32Val);
-            output = (void*)&ui32Val;
-            outputSize = sizeof(int32_t);
-            break;
-        case DBUS_TYPE_UINT64:
-            dbus_message_iter_get_basic(variant, &ui64Val);
-            if (DEBUG) printf("\tUInt64: %zu\n", ui64Val);
-            output = (void*)&ui64Val;
-            outputSize = sizeof(uint64_t);
-            break;
-        case DBUS_TYPE_DOUBLE:
-            dbus_message_iter_get_basic(variant, &dblVal);
-            if (DEBUG) printf("\tDouble: %f\n", dblVal);
-            output = (void*)&dblVal;
-            outputSize = sizeof(double);
-            break;
-        case DBUS_TYPE_ARRAY:
-            dbus_message_iter_recurse(variant, &arr);
-            while ((dbus_message_iter_get_arg_type(&arr)) != DBUS_TYPE_INVALID) {
-                process_variant(&arr, key, meta);
-                dbus_message_iter_next(&arr);
-            }
-            break;
-        default:
-            printf("\tUnhandled variant type: %d\n", varType);
+    if (err == SPOTIFY_NOT_RUNNING) {
+        fprintf(stderr, "ERROR: is Spotify running?\n");
+    } else if (err != SPOTIFY_OK) {
+        fprintf(stderr, "ERROR: %s\n", error->message);
     }
-    if (output != NULL) {
-        insert_metadata(meta, key, varType, output, outputSize);
+    if (err != SPOTIFY_OK) {
+        dbus_error_free(error);
     }
+    return err;
 }
 
-void print_usage()
+/**
+ * Builds the path of the per-user state file `name` into `out`
+ *
+ * State files live in $XDG_RUNTIME_DIR when available, otherwise in RUNTIME_FALLBACK_DIR under
+ * the world-writable /tmp: that directory is created private, and only used if it is a real
+ * directory owned by the user & closed to others, so that nobody else can plant files (or
+ * symlinks) in it.
+ *
+ * @return 1 on success, 0 if there is no safe place for the file
+ */
+static int runtime_file_path(const char *name, char *out, size_t outSize)
 {
-    printf("usage: spotify-dbus [command]\n\n  COMMANDS:\n");
-    printf("    track       print current track artist+title\n");
-    printf("    p|play      play/pause\n");
-    printf("    next        skip to next track in the tracklist\n");
-    printf("    prev        skip to beginning of track/previous track\n");
-    printf("    metadata    print out all available metadata\n");
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    char fallbackDir[64];
+    struct stat st;
+
+    if (runtimeDir != NULL && runtimeDir[0] != '\0') {
+        snprintf(out, outSize, "%s/spotify-dbus.%s", runtimeDir, name);
+        return 1;
+    }
+    snprintf(fallbackDir, sizeof(fallbackDir), RUNTIME_FALLBACK_DIR, (unsigned)getuid());
+    if (mkdir(fallbackDir, 0700) != 0 && errno != EEXIST) {
+        return 0;
+    }
+    if (lstat(fallbackDir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid()
+            || (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+        return 0;
+    }
+    snprintf(out, outSize, "%s/spotify-dbus.%s", fallbackDir, name);
+    return 1;
 }
 
-// N.B.: `metadata` is expected to have already been initialized with init_metadata_array
-void get_dbus_metadata(DBusConnection *conn, MetadataArray *metadata, DBusError *error)
+/**
+ * Stores the last successfully printed track line in the on-disk cache
+ *
+ * The file is written under a fresh temporary name (mkstemp: created exclusively, mode 0600)
+ * then renamed, so that a concurrent reader never sees a partially-written line. Failures are
+ * ignored: the cache is only a fallback.
+ */
+void write_track_cache(const char *line)
 {
-    DBusMessage *msg, *reply;
-    DBusMessageIter args, iter_array, dict_entry, dict, variant;
-    char *key;
+    char path[512], tmpPath[560];
+    size_t len = strlen(line);
+    int fd, written;
 
-    msg = dbus_message_new_method_call(
-        "org.mpris.MediaPlayer2.spotify",   // target for the method call
-        "/org/mpris/MediaPlayer2",          // object to call on
-        "org.freedesktop.DBus.Properties",  // interface to call on
-        "Get"                               // method name
-    );
-    if (msg == NULL) {
-        fprintf(stderr, "ERROR: DBus message was NULL\n");
-        exit(1);
+    if (!runtime_file_path("track", path, sizeof(path))) {
+        return;
     }
-
-    const char *interface_name = "org.mpris.MediaPlayer2.Player";
-    const char *property_name = "Metadata";
-
-    dbus_message_iter_init_append(msg, &args);
-    dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &interface_name);
-    dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &property_name);
-
-    // Send the message & get a handle for the reply
-    reply = dbus_connection_send_with_reply_and_block(conn, msg, -1, error);
-    check_error(error);
-
-    // Read metadata iteratively
-    if (dbus_message_iter_init(reply, &args)) {
-        dbus_message_iter_recurse(&args, &iter_array);
-
-        while (dbus_message_iter_get_arg_type(&iter_array) != DBUS_TYPE_INVALID) {
-            dbus_message_iter_recurse(&iter_array, &dict_entry);
-
-            while (dbus_message_iter_get_arg_type(&dict_entry) != DBUS_TYPE_INVALID) {
-                dbus_message_iter_recurse(&dict_entry, &dict);
-                dbus_message_iter_get_basic(&dict, &key);
-                if (DEBUG) printf("%s\n", key);
-
-                dbus_message_iter_next(&dict);
-                dbus_message_iter_recurse(&dict, &variant);
-
-                process_variant(&variant, key, metadata);
-                dbus_message_iter_next(&dict_entry);
-            }
-
-            dbus_message_iter_next(&iter_array);
-        }
-    } else {
-        printf("Reply does not have arguments!\n");
+    snprintf(tmpPath, sizeof(tmpPath), "%s.XXXXXX", path);
+    fd = mkstemp(tmpPath);
+    if (fd < 0) {
+        return;
+    }
+    written = write(fd, line, len) == (ssize_t)len;
+    if (close(fd) != 0 || !written || rename(tmpPath, path) != 0) {
+        unlink(tmpPath);
     }
-
-    // Free the message
-    dbus_message_unref(msg);
-    dbus_message_unref(reply);
 }
 
 /**
- * `track` command: prints out "[ARTIST] - [TITLE]" (typically for i3 status bar usage)
+ * Reads the last known track line from the on-disk cache
+ *
+ * @return 1 if a cached line was read into `out`, 0 otherwise
  */
-int command_track(DBusConnection *conn, DBusError *error) // MetadataArray *metadata)
+int read_track_cache(char *out, size_t outSize)
 {
-    int retval = 0;
-    char *artist = NULL;
-    char *title = NULL;
-    MetadataArray metadata;
-
-    init_metadata_array(&metadata);
-    get_dbus_metadata(conn, &metadata, error);
-    GetMetadataResult ret1 = get_value(&metadata, "xesam:artist", DBUS_TYPE_STRING, &artist);
-    GetMetadataResult ret2 = get_value(&metadata, "xesam:title", DBUS_TYPE_STRING, &title);
+    char path[512];
+    size_t len;
+    FILE *f;
 
-    if (ret1 != VALUE_FOUND || ret2 != VALUE_FOUND) {
-        fprintf(stderr, "Could not read artist/track metadata.\n");
-        retval = 1;
-    } else {
-        printf("%s - %s", artist, title);
-        retval = 0;
+    if (!runtime_file_path("track", path, sizeof(path))) {
+        return 0;
     }
-    free(artist);
-    free(title);
-    free_metadata_array(&metadata);
-
-    return retval;
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    len = fread(out, 1, outSize - 1, f);
+    fclose(f);
+    out[len] = '\0';
+    return len > 0;
 }
 
-int command_play_pause(DBusConnection *conn, DBusError *error)
+/**
+ * Builds the path key of a dict entry from its (basic-typed) key
+ *
+ * @return 1 on success, 0 if the dict key type is not supported or the path would be truncated
+ */
+static int dict_entry_path(DBusMessageIter *entry, const char *parentKey, char *out, size_t outSize)
 {
-    DBusMessage *msg, *reply;
+    int keyType = dbus_message_iter_get_arg_type(entry);
+    int written;
 
-    msg = dbus_message_new_method_call(
-        "org.mpris.MediaPlayer2.spotify",
-        "/org/mpris/MediaPlayer2",
-        "org.mpris.MediaPlayer2.Player",
-        "PlayPause"
-    );
-    if (msg == NULL) {
-        fprintf(stderr, "ERROR: DBusMessage was NULL\n");
-        exit(1);
+    if (is_string_type(keyType)) {
+        const char *strKey;
+        dbus_message_iter_get_basic(entry, &strKey);
+        written = snprintf(out, outSize, "%s.%s", parentKey, strKey);
+    } else if (fixed_type_size(keyType) > 0 && keyType != DBUS_TYPE_DOUBLE) {
+        DBusBasicValue basic;
+        int64_t intKey;
+        dbus_message_iter_get_basic(entry, &basic);
+        switch (keyType) {
+            case DBUS_TYPE_BYTE:    intKey = basic.byt; break;
+            case DBUS_TYPE_BOOLEAN: intKey = basic.bool_val; break;
+            case DBUS_TYPE_INT16:   intKey = basic.i16; break;
+            case DBUS_TYPE_UINT16:  intKey = basic.u16; break;
+            case DBUS_TYPE_INT32:   intKey = basic.i32; break;
+            case DBUS_TYPE_UINT32:  intKey = basic.u32; break;
+            case DBUS_TYPE_INT64:   intKey = basic.i64; break;
+            default:                intKey = (int64_t)basic.u64; break;
+        }
+        written = snprintf(out, outSize, "%s.%" PRId64, parentKey, intKey);
+    } else {
+        return 0;
     }
-
-    reply = dbus_connection_send_with_reply_and_block(conn, msg, -1, error);
-    check_error(error);
-
-    dbus_message_unref(msg);
-    dbus_message_unref(reply);
-
-    return 0;
+    return written >= 0 && (size_t)written < outSize;
 }
 
 /**
- * Skips to next or previous track
+ * Recursively decodes the value pointed to by `iter` into `meta`, under the path `key`
  */
-int command_next_or_prev(NextOrPrev go_next, DBusConnection *conn, DBusError *error)
+static void decode_value(DBusMessageIter *iter, const char *key, int32_t parent, uint32_t depth,
+                         MetadataArray *meta)
 {
-    DBusMessage *msg, *reply;
+    int varType = dbus_message_iter_get_arg_type(iter);
+    char childKey[MAX_KEY_LENGTH];
+    DBusMessageIter sub, entry;
+    DBusBasicValue basic;
+    int32_t self;
+    uint32_t index = 0;
 
-    msg = dbus_message_new_method_call(
-        "org.mpris.MediaPlayer2.spotify",
-        "/org/mpris/MediaPlayer2",
-        "org.mpris.MediaPlayer2.Player",
-        go_next == NEXT ? "Next" : "Previous"
-    );
+    if (depth > MAX_DECODE_DEPTH) {
+        if (DEBUG) fprintf(stderr, "\tMaximum decode depth reached at %s\n", key);
+        return;
+    }
+
+    if (is_string_type(varType)) {
+        dbus_message_iter_get_basic(iter, &basic.str);
+        if (DEBUG) printf("\tString: %s\n", basic.str);
+        insert_metadata(meta, key, varType, basic.str, 0, parent, depth);
+        return;
+    }
+    if (fixed_type_size(varType) > 0) {
+        dbus_message_iter_get_basic(iter, &basic);
+        insert_metadata(meta, key, varType, &basic, fixed_type_size(varType), parent, depth);
+        return;
+    }
+
+    switch (varType) {
+        case DBUS_TYPE_VARIANT:
+            // Variants are transparent: the contained value takes the variant's place in the tree
+            dbus_message_iter_recurse(iter, &sub);
+            decode_value(&sub, key, parent, depth + 1, meta);
+            break;
+        case DBUS_TYPE_ARRAY:
+        case DBUS_TYPE_STRUCT:
+            self = insert_metadata(meta, key, varType, NULL, 0, parent, depth);
+            if (self < 0) {
+                return;
+            }
+            dbus_message_iter_recurse(iter, &sub);
+            while (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID) {
+                if (dbus_message_iter_get_arg_type(&sub) == DBUS_TYPE_DICT_ENTRY) {
+                    dbus_message_iter_recurse(&sub, &entry);
+                    if (dict_entry_path(&entry, key, childKey, sizeof(childKey))) {
+                        dbus_message_iter_next(&entry);
+                        decode_value(&entry, childKey, self, depth + 1, meta);
+                    }
+                } else {
+                    int written = snprintf(childKey, sizeof(childKey), "%s[%u]", key, index);
+                    if (written >= 0 && (size_t)written < sizeof(childKey)) {
+                        decode_value(&sub, childKey, self, depth + 1, meta);
+                    }
+                }
+                index++;
+                dbus_message_iter_next(&sub);
+            }
+            break;
+        default:
+            // Unix FDs & anything unknown carry no displayable metadata
+            if (DEBUG) fprintf(stderr, "\tSkipping variant type: %d\n", varType);
+            break;
+    }
+}
+
+/**
+ * Processes a DBusMessageIter and adds the key/values encountered into a MetadataArray
+ *
+ * Nested values (arrays, structs, dicts & variants) are decoded recursively into the flattened
+ * path tree described in MetadataItem, down to MAX_DECODE_DEPTH levels.
+ */
+void process_variant(DBusMessageIter *variant, const char *key, MetadataArray *meta)
+{
+    decode_value(variant, key, -1, 0, meta);
+}
+
+typedef struct {
+    const char *name;
+    const char *key;
+    TrackFieldKind kind;
+    size_t offset;
+} TrackFieldSpec;
+
+#define TRACK_FIELD_SPEC(name, key, kind)   { #name, key, kind, offsetof(TrackInfo, name) },
+
+static const TrackFieldSpec track_schema[TRACK_FIELD_COUNT] = {
+    TRACK_SCHEMA(TRACK_FIELD_SPEC)
+};
+
+void init_track_info(TrackInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+}
+
+/**
+ * Copies a string into a TrackInfo string field, truncating on a UTF-8 character boundary
+ */
+static void copy_track_string(char *dst, const char *src)
+{
+    size_t len = strlen(src);
+
+    if (len >= TRACK_STRING_SIZE) {
+        len = TRACK_STRING_SIZE - 1;
+        while (len > 0 && ((unsigned char)src[len] & 0xC0) == 0x80) {
+            len--;
+        }
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+/**
+ * Reads any D-Bus integer type as an int64_t
+ *
+ * @return 1 if the value is an integer, 0 otherwise
+ */
+static int read_integer(DBusMessageIter *iter, int64_t *out)
+{
+    DBusBasicValue basic;
+
+    switch (dbus_message_iter_get_arg_type(iter)) {
+        case DBUS_TYPE_BYTE:   dbus_message_iter_get_basic(iter, &basic); *out = basic.byt; return 1;
+        case DBUS_TYPE_INT16:  dbus_message_iter_get_basic(iter, &basic); *out = basic.i16; return 1;
+        case DBUS_TYPE_UINT16: dbus_message_iter_get_basic(iter, &basic); *out = basic.u16; return 1;
+        case DBUS_TYPE_INT32:  dbus_message_iter_get_basic(iter, &basic); *out = basic.i32; return 1;
+        case DBUS_TYPE_UINT32: dbus_message_iter_get_basic(iter, &basic); *out = basic.u32; return 1;
+        case DBUS_TYPE_INT64:  dbus_message_iter_get_basic(iter, &basic); *out = basic.i64; return 1;
+        case DBUS_TYPE_UINT64: dbus_message_iter_get_basic(iter, &basic); *out = (int64_t)basic.u64; return 1;
+        default: return 0;
+    }
+}
+
+/**
+ * Decodes one metadata value into the TrackInfo field described by `spec`
+ *
+ * @return 1 if the value matched the field kind & was stored, 0 otherwise
+ */
+static int decode_track_field(TrackInfo *info, const TrackFieldSpec *spec, DBusMessageIter *value)
+{
+    char *field = (char*)info + spec->offset;
+    DBusMessageIter sub;
+    const char *str;
+    int64_t integer;
+
+    switch (spec->kind) {
+        case FIELD_FIRST_STRING:
+            if (dbus_message_iter_get_arg_type(value) != DBUS_TYPE_ARRAY) {
+                return 0;
+            }
+            dbus_message_iter_recurse(value, &sub);
+            value = &sub;
+            // fall through
+        case FIELD_STRING:
+            if (!is_string_type(dbus_message_iter_get_arg_type(value))) {
+                return 0;
+            }
+            dbus_message_iter_get_basic(value, &str);
+            copy_track_string(field, str);
+            return 1;
+        case FIELD_INT64:
+            if (!read_integer(value, &integer)) {
+                return 0;
+            }
+            *(int64_t*)field = integer;
+            return 1;
+        case FIELD_INT32:
+            if (!read_integer(value, &integer)) {
+                return 0;
+            }
+            *(int32_t*)field = (int32_t)integer;
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Stores a metadata entry into a TrackInfo
+ *
+ * Keys that are not part of TRACK_SCHEMA (or whose value does not match the schema type) are
+ * dropped: the full metadata tree is only decoded by `metadata`, through process_variant.
+ */
+void decode_track_entry(TrackInfo *info, const char *key, DBusMessageIter *value)
+{
+    for (uint32_t i = 0; i < TRACK_FIELD_COUNT; ++i) {
+        if (strcmp(track_schema[i].key, key) == 0) {
+            if (decode_track_field(info, &track_schema[i], value)) {
+                info->present |= 1u << i;
+            }
+            return;
+        }
+    }
+}
+
+void print_usage(Output *out)
+{
+    output_str(out, "usage: spotify-dbus [options] [command]\n\n  OPTIONS:\n");
+    output_str(out, "    -t|--timeout MS   deadline for each D-Bus call (default: ");
+    output_int(out, DEFAULT_TIMEOUT_MS);
+    output_str(out, ", 0 waits forever)\n");
+    output_str(out, "    --confirm         make control commands wait for Spotify's reply\n");
+    output_str(out, "    --libdbus         make `track` use libdbus instead of the built-in wire client\n");
+    output_str(out, "    --json            print `track` & `follow` as i3bar/waybar JSON blocks\n");
+    output_str(out, "    --pango           escape `track` & `follow` lines for Pango markup (i3blocks markup=pango)\n");
+    output_str(out, "    --max-width N     cut `track` & `follow` lines to N columns, with an ellipsis\n");
+    output_str(out, "    --replay FILE     serve the player's replies & signals from a capture file instead of the bus\n");
+    output_str(out, "    --window MS       coalescing window for bursts of next/prev/seek/volume (default: ");
+    output_int(out, DEFAULT_COALESCE_WINDOW_MS);
+    output_str(out, ", 0 disables)\n");
+    output_str(out, "    --settle MS       time a burst of player signals gets to settle before `follow` & co. show it (default: ");
+    output_int(out, DEFAULT_SETTLE_WINDOW_MS);
+    output_str(out, ")\n");
+    output_str(out, "\n  COMMANDS:\n");
+    output_str(out, "    track       print current track artist+title\n");
+    output_str(out, "    track --marquee WIDTH [--speed HZ]  scroll artist+title through WIDTH columns\n");
+    output_str(out, "    p|play      play/pause\n");
+    output_str(out, "    next        skip to next track in the tracklist\n");
+    output_str(out, "    prev        skip to beginning of track/previous track\n");
+    output_str(out, "    seek ±N     move the playback position by N seconds\n");
+    output_str(out, "    position T  jump to T seconds into the current track\n");
+    output_str(out, "    volume [±]N set the volume to N%, or change it by N percent points\n");
+    output_str(out, "    metadata    print out all available metadata\n");
+    output_str(out, "    follow      print artist+title on every track change, surviving Spotify restarts\n");
+    output_str(out, "    wait [--field KEY]  block until the track (or a metadata field) changes, print the new value\n");
+    output_str(out, "    serve       answer spotify-dbus-client requests over a Unix socket\n");
+    output_str(out, "    record FILE [-n N]  record Spotify's replies & N change signals into a capture for --replay\n");
+    output_str(out, "    bench CMD [-n N]  run CMD N times in-process, report latency & perf counters\n");
+    output_str(out, "    bench backend [-n N]  cost of the backend indirection (with --replay)\n");
+    output_str(out, "    bench escape [-n N]   throughput of the Pango & JSON escaping kernels\n");
+    output_str(out, "    bench decode [-n N]   decode throughput over the payloads of a capture (with --replay)\n");
+}
+
+/**
+ * Destination to address Spotify calls to: its unique name when resolved, so that the bus
+ * daemon does not have to look the well-known name up on every call
+ */
+const char *player_destination()
+{
+    return player_owner[0] != '\0' ? player_owner : SPOTIFY_BUS_NAME;
+}
+
+/**
+ * Records the new owner of Spotify's bus name (an empty string when Spotify went away)
+ */
+void set_player_owner(const char *owner)
+{
+    snprintf(player_owner, sizeof(player_owner), "%s", owner);
+}
+
+/**
+ * Resolves Spotify's unique bus name with a single GetNameOwner call
+ *
+ * A NameOwnerChanged match rule is installed beforehand, so that later owner changes (Spotify
+ * quitting or restarting) are seen as signals on the connection and fed to set_player_owner,
+ * without having to wait for a failed call.
+ * Only worth it for connections making several calls: one-shot single-call commands address
+ * the well-known name directly rather than paying an extra round trip.
+ */
+SpotifyError resolve_player(Backend *backend, DBusError *error)
+{
+    DBusMessage *msg, *reply;
+    const char *busName = SPOTIFY_BUS_NAME;
+    const char *owner;
+
+    if (!watching_player_owner) {
+        if (!backend->ops->subscribe(backend, NAME_OWNER_CHANGED_RULE, error)) {
+            return classify_error(error);
+        }
+        watching_player_owner = 1;
+    }
+
+    msg = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "GetNameOwner");
+    if (msg == NULL || !dbus_message_append_args(msg, DBUS_TYPE_STRING, &busName, DBUS_TYPE_INVALID)) {
+        if (msg != NULL) {
+            dbus_message_unref(msg);
+        }
+        dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, "DBus message was NULL");
+        return SPOTIFY_NO_MEMORY;
+    }
+    backend->ops->call_method(backend, msg, call_timeout_ms, &reply, error);
+    dbus_message_unref(msg);
+    if (reply == NULL) {
+        set_player_owner("");
+        return classify_error(error);
+    }
+    if (!dbus_message_get_args(reply, error, DBUS_TYPE_STRING, &owner, DBUS_TYPE_INVALID)) {
+        dbus_message_unref(reply);
+        return classify_error(error);
+    }
+    set_player_owner(owner);
+    dbus_message_unref(reply);
+    return SPOTIFY_OK;
+}
+
+/**
+ * Forgets the resolved owner of Spotify's bus name when a call to it failed because it is gone
+ * (a restart we have not heard of yet)
+ */
+static void forget_lost_player(const DBusError *error)
+{
+    if (player_owner[0] != '\0' && classify_error(error) == SPOTIFY_NOT_RUNNING) {
+        set_player_owner("");
+    }
+}
+
+/**
+ * Sends a method call to Spotify (addressed to player_destination()) and waits for the reply
+ * within the call deadline
+ *
+ * @return The reply, or NULL with `error` set
+ */
+DBusMessage *call_player(Backend *backend, DBusMessage *msg, DBusError *error)
+{
+    DBusMessage *reply = NULL;
+
+    backend->ops->call_method(backend, msg, call_timeout_ms, &reply, error);
+    if (reply == NULL) {
+        forget_lost_player(error);
+    }
+    return reply;
+}
+
+/**
+ * Positions `value` on the property value held in the variant of a Properties.Get reply
+ *
+ * @return 1 on success, 0 with `error` set if the reply is malformed
+ */
+static int property_reply_value(DBusMessage *reply, DBusMessageIter *value, DBusError *error)
+{
+    DBusMessageIter args;
+
+    if (!dbus_message_iter_init(reply, &args) || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_VARIANT) {
+        dbus_set_error_const(error, SPOTIFY_ERROR_BAD_REPLY, "Property reply does not hold a variant");
+        return 0;
+    }
+    dbus_message_iter_recurse(&args, value);
+    return 1;
+}
+
+/**
+ * Reads a property of the org.mpris.MediaPlayer2.Player interface
+ *
+ * @return The reply (to be unreferenced by the caller) with `value` pointing at the property
+ *         value inside its variant, or NULL with `error` set
+ */
+DBusMessage *get_player_property(Backend *backend, const char *property, DBusMessageIter *value,
+                                 DBusError *error)
+{
+    DBusMessage *reply;
+
+    reply = backend->ops->get_property(backend, player_destination(), MPRIS_PATH, MPRIS_PLAYER_INTERFACE,
+                                       property, call_timeout_ms, error);
+    if (reply == NULL) {
+        forget_lost_player(error);
+        return NULL;
+    }
+    if (!property_reply_value(reply, value, error)) {
+        dbus_message_unref(reply);
+        return NULL;
+    }
+    return reply;
+}
+
+/**
+ * Iterates over the entries of an a{sv} dict (as found in the Metadata property)
+ *
+ * @param entries   Iterator recursed into the dict array, advanced on each call
+ * @return 1 with `key` & `value` (the variant contents) set to the next entry, 0 when done
+ */
+static int next_dict_entry(DBusMessageIter *entries, const char **key, DBusMessageIter *value)
+{
+    DBusMessageIter entry, variant;
+
+    while (dbus_message_iter_get_arg_type(entries) == DBUS_TYPE_DICT_ENTRY) {
+        dbus_message_iter_recurse(entries, &entry);
+        dbus_message_iter_next(entries);
+        if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_STRING) {
+            continue;
+        }
+        dbus_message_iter_get_basic(&entry, key);
+        if (DEBUG) printf("%s\n", *key);
+
+        dbus_message_iter_next(&entry);
+        if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_VARIANT) {
+            continue;
+        }
+        dbus_message_iter_recurse(&entry, &variant);
+        *value = variant;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Positions `entries` on the first dict entry of a Metadata property reply
+ *
+ * @return 1 on success, 0 with `error` set if the reply is malformed
+ */
+static int metadata_reply_entries(DBusMessage *reply, DBusMessageIter *entries, DBusError *error)
+{
+    DBusMessageIter dict;
+
+    if (!property_reply_value(reply, &dict, error)) {
+        return 0;
+    }
+    if (dbus_message_iter_get_arg_type(&dict) != DBUS_TYPE_ARRAY) {
+        dbus_set_error_const(error, SPOTIFY_ERROR_BAD_REPLY, "Metadata is not a dict");
+        return 0;
+    }
+    dbus_message_iter_recurse(&dict, entries);
+    return 1;
+}
+
+/**
+ * Reads the Metadata property and positions `entries` on its first dict entry
+ *
+ * @return The reply (to be unreferenced by the caller), or NULL with `error` set
+ */
+static DBusMessage *get_metadata_entries(Backend *backend, DBusMessageIter *entries, DBusError *error)
+{
+    DBusMessage *reply;
+
+    reply = backend->ops->get_property(backend, player_destination(), MPRIS_PATH, MPRIS_PLAYER_INTERFACE,
+                                       "Metadata", call_timeout_ms, error);
+    if (reply == NULL) {
+        forget_lost_player(error);
+        return NULL;
+    }
+    if (!metadata_reply_entries(reply, entries, error)) {
+        dbus_message_unref(reply);
+        return NULL;
+    }
+    return reply;
+}
+
+/**
+ * Positions `entries` on the first entry of the Metadata dict carried by a PropertiesChanged
+ * signal (org.freedesktop.DBus.Properties: interface name, changed properties, invalidated ones)
+ *
+ * @return 1 on success, 0 if the signal does not carry a new Metadata value
+ */
+static int changed_metadata_entries(DBusMessage *signal, DBusMessageIter *entries)
+{
+    DBusMessageIter args, changed, value;
+    const char *key;
+
+    if (!dbus_message_iter_init(signal, &args) || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_STRING
+            || !dbus_message_iter_next(&args) || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY) {
+        return 0;
+    }
+    dbus_message_iter_recurse(&args, &changed);
+    while (next_dict_entry(&changed, &key, &value)) {
+        if (strcmp(key, "Metadata") == 0 && dbus_message_iter_get_arg_type(&value) == DBUS_TYPE_ARRAY) {
+            dbus_message_iter_recurse(&value, entries);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Fetches the current track metadata from Spotify into `metadata`
+ *
+ * N.B.: `metadata` is expected to have already been initialized with init_metadata_array
+ *
+ * @return SPOTIFY_OK on success. On failure `error` is set and left for the caller to inspect
+ *         or report with check_error.
+ */
+SpotifyError get_dbus_metadata(Backend *backend, MetadataArray *metadata, DBusError *error)
+{
+    DBusMessage *reply;
+    DBusMessageIter entries, variant;
+    const char *key;
+
+    reply = get_metadata_entries(backend, &entries, error);
+    if (reply == NULL) {
+        return classify_error(error);
+    }
+
+    // Read metadata iteratively
+    while (next_dict_entry(&entries, &key, &variant)) {
+        process_variant(&variant, key, metadata);
+    }
+
+    // Free the reply
+    dbus_message_unref(reply);
+    return SPOTIFY_OK;
+}
+
+/**
+ * Fetches the current track metadata from Spotify straight into a TrackInfo
+ *
+ * @return SPOTIFY_OK on success. On failure `error` is set, as for get_dbus_metadata.
+ */
+SpotifyError get_track_info(Backend *backend, TrackInfo *info, DBusError *error)
+{
+    DBusMessage *reply;
+    DBusMessageIter entries, variant;
+    const char *key;
+
+    reply = get_metadata_entries(backend, &entries, error);
+    if (reply == NULL) {
+        return classify_error(error);
+    }
+
+    init_track_info(info);
+    while (next_dict_entry(&entries, &key, &variant)) {
+        decode_track_entry(info, key, &variant);
+    }
+
+    dbus_message_unref(reply);
+    return SPOTIFY_OK;
+}
+
+/**
+ * Sends a control message to Spotify
+ *
+ * Unless --confirm was given, the call is flagged NO_REPLY, flushed to the bus and not waited
+ * for: control commands then return without a round trip to Spotify. In that mode a call to a
+ * Spotify that is not running is silently dropped by the bus.
+ */
+SpotifyError send_player_control(Backend *backend, DBusMessage *msg, DBusError *error)
+{
+    DBusMessage *reply;
+
+    if (!confirm_calls) {
+        if (!backend->ops->call_method(backend, msg, call_timeout_ms, NULL, error)) {
+            return classify_error(error);
+        }
+        return SPOTIFY_OK;
+    }
+
+    reply = call_player(backend, msg, error);
+    if (reply == NULL) {
+        return classify_error(error);
+    }
+    dbus_message_unref(reply);
+
+    return SPOTIFY_OK;
+}
+
+/**
+ * Calls an argument-less method of the org.mpris.MediaPlayer2.Player interface
+ */
+SpotifyError call_player_method(Backend *backend, const char *method, DBusError *error)
+{
+    DBusMessage *msg;
+    SpotifyError err;
+
+    msg = dbus_message_new_method_call(player_destination(), MPRIS_PATH, MPRIS_PLAYER_INTERFACE, method);
     if (msg == NULL) {
-        fprintf(stderr, "ERROR: DBusMessage was NULL\n");
-        exit(1);
+        dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, "DBusMessage was NULL");
+        return SPOTIFY_NO_MEMORY;
+    }
+
+    err = send_player_control(backend, msg, error);
+    dbus_message_unref(msg);
+
+    return err;
+}
+
+/**
+ * Sleeps for `ms` milliseconds, resuming after signal interruptions
+ */
+static void sleep_ms(int ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+typedef SpotifyError (*DeltaSender)(Backend *backend, double delta, DBusError *error);
+
+/**
+ * Relative amount accumulated in a coalescing file, along with the process sending it
+ */
+typedef struct {
+    long leader;
+    double pending;
+    uint64_t lastSentNs;    // monotonic_ns of the last send (CLOCK_MONOTONIC is system-wide)
+} PendingDelta;
+
+static void read_pending_delta(int fd, PendingDelta *p)
+{
+    char buf[96];
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    unsigned long long lastSentNs = 0;
+
+    p->leader = 0;
+    p->pending = 0;
+    p->lastSentNs = 0;
+    if (len > 0) {
+        buf[len] = '\0';
+        if (sscanf(buf, "%ld %lf %llu", &p->leader, &p->pending, &lastSentNs) != 3) {
+            p->leader = 0;
+            p->pending = 0;
+            lastSentNs = 0;
+        }
+        p->lastSentNs = lastSentNs;
+    }
+}
+
+static int write_pending_delta(int fd, const PendingDelta *p)
+{
+    char buf[96];
+    int len = snprintf(buf, sizeof(buf), "%ld %.17g %llu\n", p->leader, p->pending,
+                       (unsigned long long)p->lastSentNs);
+
+    return ftruncate(fd, 0) == 0 && pwrite(fd, buf, len, 0) == len;
+}
+
+static int is_process_alive(long pid)
+{
+    return pid > 0 && (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+}
+
+/**
+ * Applies a relative change (seek offset, volume step...) with burst coalescing
+ *
+ * Each invocation adds its delta to a shared per-user file under an exclusive lock. An
+ * invocation arriving more than coalesce_window_ms after the last send is not part of a burst:
+ * it sends right away & exits, so a single press costs no more than without coalescing. One
+ * that follows within the window becomes the leader of the burst: it sends the accumulated
+ * amount right away, then keeps collecting for coalesce_window_ms and sends the net delta of
+ * everything that arrived meanwhile in a single call, until a window passes without new input.
+ * The other invocations of the burst only add their delta and exit, so a fast mouse-wheel spin
+ * results in a handful of D-Bus calls instead of one blocking round trip per notch.
+ *
+ * @param name      Name of the coalescing file (one per kind of change)
+ * @param delta     The relative change requested by this invocation
+ * @param send      Function applying a net delta through D-Bus
+ */
+SpotifyError coalesce_delta(const char *name, double delta, DeltaSender send, Backend *backend,
+                            DBusError *error)
+{
+    char path[512];
+    PendingDelta p;
+    SpotifyError err = SPOTIFY_OK;
+    double amount;
+    int fd;
+
+    if (coalesce_window_ms <= 0) {
+        return send(backend, delta, error);
+    }
+    if (!runtime_file_path(name, path, sizeof(path))) {
+        return send(backend, delta, error);
+    }
+    fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return send(backend, delta, error);
+    }
+
+    read_pending_delta(fd, &p);
+    p.pending += delta;
+    if (p.leader != (long)getpid() && is_process_alive(p.leader)) {
+        // A leader is already sending this burst and will pick our delta up
+        write_pending_delta(fd, &p);
+        flock(fd, LOCK_UN);
+        close(fd);
+        return SPOTIFY_OK;
+    }
+
+    if (monotonic_ns() - p.lastSentNs >= (uint64_t)coalesce_window_ms * 1000000) {
+        // First of a burst, or a lone press: no reason to linger
+        amount = p.pending;
+        p.leader = 0;
+        p.pending = 0;
+        p.lastSentNs = monotonic_ns();
+        write_pending_delta(fd, &p);
+        flock(fd, LOCK_UN);
+        close(fd);
+        return amount != 0 ? send(backend, amount, error) : SPOTIFY_OK;
+    }
+
+    p.leader = (long)getpid();
+    while (1) {
+        amount = p.pending;
+        p.pending = 0;
+        p.lastSentNs = monotonic_ns();
+        write_pending_delta(fd, &p);
+        flock(fd, LOCK_UN);
+
+        if (amount != 0) {
+            err = send(backend, amount, error);
+        }
+        sleep_ms(coalesce_window_ms);
+
+        flock(fd, LOCK_EX);
+        read_pending_delta(fd, &p);
+        if (p.pending == 0 || err != SPOTIFY_OK) {
+            // Burst over (or Spotify failing): step down & drop what could not be sent
+            p.leader = 0;
+            p.pending = 0;
+            write_pending_delta(fd, &p);
+            break;
+        }
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    return err;
+}
+
+/**
+ * Parses a signed decimal command argument
+ *
+ * @param isRelative    Set to 1 if the argument starts with '+' or '-', 0 otherwise (may be NULL)
+ * @return 1 if the argument is a valid number, 0 otherwise
+ */
+static int parse_amount(const char *arg, double *out, int *isRelative)
+{
+    char *end;
+
+    if (arg == NULL || arg[0] == '\0') {
+        return 0;
+    }
+    *out = strtod(arg, &end);
+    if (*end != '\0') {
+        return 0;
+    }
+    if (isRelative != NULL) {
+        *isRelative = arg[0] == '+' || arg[0] == '-';
+    }
+    return 1;
+}
+
+/**
+ * Calls Player.Seek with an offset in seconds
+ */
+static SpotifyError send_seek(Backend *backend, double seconds, DBusError *error)
+{
+    DBusMessage *msg;
+    SpotifyError err;
+    dbus_int64_t offset = (dbus_int64_t)(seconds * SEEK_UNIT_US);
+
+    msg = dbus_message_new_method_call(player_destination(), MPRIS_PATH, MPRIS_PLAYER_INTERFACE, "Seek");
+    if (msg == NULL || !dbus_message_append_args(msg, DBUS_TYPE_INT64, &offset, DBUS_TYPE_INVALID)) {
+        if (msg != NULL) {
+            dbus_message_unref(msg);
+        }
+        dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, "DBusMessage was NULL");
+        return SPOTIFY_NO_MEMORY;
+    }
+    err = send_player_control(backend, msg, error);
+    dbus_message_unref(msg);
+
+    return err;
+}
+
+/**
+ * Writes the Player.Volume property (0.0 to 1.0, clamped)
+ */
+static SpotifyError set_volume(Backend *backend, double volume, DBusError *error)
+{
+    DBusMessage *msg;
+    DBusMessageIter args, variant;
+    SpotifyError err;
+    const char *interface_name = MPRIS_PLAYER_INTERFACE;
+    const char *property_name = "Volume";
+
+    volume = volume < 0.0 ? 0.0 : (volume > 1.0 ? 1.0 : volume);
+    msg = dbus_message_new_method_call(player_destination(), MPRIS_PATH, "org.freedesktop.DBus.Properties", "Set");
+    if (msg == NULL) {
+        dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, "DBusMessage was NULL");
+        return SPOTIFY_NO_MEMORY;
+    }
+    dbus_message_iter_init_append(msg, &args);
+    dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &interface_name);
+    dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &property_name);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_VARIANT, DBUS_TYPE_DOUBLE_AS_STRING, &variant);
+    dbus_message_iter_append_basic(&variant, DBUS_TYPE_DOUBLE, &volume);
+    dbus_message_iter_close_container(&args, &variant);
+
+    err = send_player_control(backend, msg, error);
+    dbus_message_unref(msg);
+
+    return err;
+}
+
+/**
+ * Changes the volume by `percent` points, relative to its current value
+ */
+static SpotifyError send_volume_step(Backend *backend, double percent, DBusError *error)
+{
+    DBusMessage *reply;
+    DBusMessageIter value;
+    double volume;
+
+    reply = get_player_property(backend, "Volume", &value, error);
+    if (reply == NULL) {
+        return classify_error(error);
+    }
+    if (dbus_message_iter_get_arg_type(&value) != DBUS_TYPE_DOUBLE) {
+        dbus_message_unref(reply);
+        dbus_set_error_const(error, SPOTIFY_ERROR_BAD_REPLY, "Volume is not a double");
+        return SPOTIFY_BAD_REPLY;
+    }
+    dbus_message_iter_get_basic(&value, &volume);
+    dbus_message_unref(reply);
+
+    return set_volume(backend, volume + percent / 100.0, error);
+}
+
+/**
+ * Formats the "[ARTIST] - [TITLE]" line of a track
+ *
+ * @return SPOTIFY_OK, or SPOTIFY_NO_METADATA if artist or title is missing
+ */
+SpotifyError format_track(const TrackInfo *info, char *out, size_t outSize)
+{
+    if (!TRACK_HAS(info, artist) || !TRACK_HAS(info, title)) {
+        return SPOTIFY_NO_METADATA;
+    }
+    size_t len = (size_t)snprintf(out, outSize, "%s - %s", info->artist, info->title);
+
+    // Cut on a UTF-8 character boundary, as copy_track_string does
+    if (len >= outSize) {
+        len = outSize - 1;
+        while (len > 0 && ((unsigned char)out[len] & 0xC0) == 0x80) {
+            len--;
+        }
+        out[len] = '\0';
+    }
+    return SPOTIFY_OK;
+}
+
+/**
+ * Decodes one metadata value read by the wire client into the TrackInfo field described by `spec`
+ *
+ * @return 1 if the value matched the field kind & was stored, 0 otherwise
+ */
+static int decode_wire_track_field(TrackInfo *info, const TrackFieldSpec *spec, const WireValue *value)
+{
+    char *field = (char*)info + spec->offset;
+    WireValue element;
+    const char *str;
+    int64_t integer;
+
+    switch (spec->kind) {
+        case FIELD_FIRST_STRING:
+            if (!wire_value_first_element(value, &element)) {
+                return 0;
+            }
+            value = &element;
+            // fall through
+        case FIELD_STRING:
+            if (!wire_value_string(value, &str)) {
+                return 0;
+            }
+            copy_track_string(field, str);
+            return 1;
+        case FIELD_INT64:
+            if (!wire_value_integer(value, &integer)) {
+                return 0;
+            }
+            *(int64_t*)field = integer;
+            return 1;
+        case FIELD_INT32:
+            if (!wire_value_integer(value, &integer)) {
+                return 0;
+            }
+            *(int32_t*)field = (int32_t)integer;
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Fetches the current track through the wire client, without any libdbus connection
+ *
+ * @param err   Outcome of the call when the wire client could be used (with `error` set on
+ *              failure, as for get_track_info)
+ * @return 1 if the wire client produced an outcome, 0 if it could not be used (unsupported bus
+ *         address, authentication failure, unexpected reply...) & libdbus must be used instead
+ */
+int get_track_info_wire(TrackInfo *info, SpotifyError *err, DBusError *error)
+{
+    static WireConnection wire;
+    WireValue metadata, value;
+    WireDict dict;
+    WireStatus status;
+    const char *key;
+
+    if (wire_connect(&wire) != WIRE_OK) {
+        return 0;
+    }
+    status = wire_get_property(&wire, SPOTIFY_BUS_NAME, MPRIS_PATH, MPRIS_PLAYER_INTERFACE, "Metadata",
+                               call_timeout_ms == DBUS_TIMEOUT_INFINITE ? -1 : call_timeout_ms, &metadata);
+    if (status == WIRE_TIMEOUT) {
+        dbus_set_error_const(error, DBUS_ERROR_NO_REPLY, "Spotify did not reply within the call deadline");
+    } else if (status == WIRE_ERROR_REPLY) {
+        dbus_set_error(error, wire.errorName, "%s", wire.errorName);
+    } else if (status != WIRE_OK || !wire_dict_begin(&metadata, &dict)) {
+        wire_close(&wire);
+        return 0;
+    }
+
+    if (status == WIRE_OK) {
+        init_track_info(info);
+        while (wire_dict_next(&dict, &key, &value)) {
+            for (uint32_t i = 0; i < TRACK_FIELD_COUNT; ++i) {
+                if (strcmp(track_schema[i].key, key) == 0) {
+                    if (decode_wire_track_field(info, &track_schema[i], &value)) {
+                        info->present |= 1u << i;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    wire_close(&wire);
+    *err = classify_error(error);
+    return 1;
+}
+
+/**
+ * Reads the PlaybackStatus property ("Playing", "Paused" or "Stopped") into `out`
+ *
+ * Failures are not reported: `out` is left empty, which renders as an unknown status.
+ */
+static void get_playback_status(Backend *backend, char *out, size_t outSize)
+{
+    DBusError error;
+    DBusMessage *reply;
+    DBusMessageIter value;
+    const char *status;
+
+    out[0] = '\0';
+    dbus_error_init(&error);
+    reply = get_player_property(backend, "PlaybackStatus", &value, &error);
+    if (reply == NULL) {
+        dbus_error_free(&error);
+        return;
+    }
+    if (dbus_message_iter_get_arg_type(&value) == DBUS_TYPE_STRING) {
+        dbus_message_iter_get_basic(&value, &status);
+        snprintf(out, outSize, "%s", status);
+    }
+    dbus_message_unref(reply);
+}
+
+/**
+ * JSON block styling for each PlaybackStatus
+ */
+typedef struct {
+    const char *status;
+    const char *className;
+    const char *color;      // NULL to leave the bar's default color
+} StatusStyle;
+
+static const StatusStyle status_styles[] = {
+    { "Playing", "playing", "#1db954" },
+    { "Paused",  "paused",  "#a0a0a0" },
+    { "Stopped", "stopped", "#606060" },
+};
+static const StatusStyle unknown_status_style = { "", "unknown", NULL };
+static const StatusStyle stale_status_style = { "", "stale", "#a0a0a0" };
+
+static const StatusStyle *status_style(const char *status)
+{
+    for (size_t i = 0; i < sizeof(status_styles) / sizeof(status_styles[0]); ++i) {
+        if (strcmp(status_styles[i].status, status) == 0) {
+            return &status_styles[i];
+        }
+    }
+    return &unknown_status_style;
+}
+
+#define ESCAPE_MAX(len) (JSON_ESCAPE_MAX(len) > PANGO_ESCAPE_MAX(len) ? JSON_ESCAPE_MAX(len) : PANGO_ESCAPE_MAX(len))
+
+/**
+ * Strings of the last rendered track, cut to --max-width & escaped for the output format, with
+ * their display widths, so that renders of an unchanged track (PlaybackStatus changes, `follow`
+ * refreshes) neither measure nor escape them again
+ *
+ * Entries are keyed on the source texts themselves, not on the trackid: Spotify may update the
+ * metadata of a track without changing its trackid.
+ */
+typedef struct {
+    char line[TRACK_CACHE_SIZE];    // "ARTIST - TITLE" line the entry was rendered from
+    char title[TRACK_STRING_SIZE];  // Title the short text was rendered from
+    size_t fullWidth;
+    size_t shortWidth;
+    size_t fullLength;
+    size_t shortLength;
+    char fullText[ESCAPE_MAX(TRACK_CACHE_SIZE + sizeof(ELLIPSIS)) + 1];
+    char shortText[ESCAPE_MAX(TRACK_STRING_SIZE + sizeof(ELLIPSIS)) + 1];
+} RenderedTrackCache;
+
+static RenderedTrackCache rendered_track_cache;
+
+/**
+ * Cuts text to --max-width (if set) & escapes it for the output format
+ *
+ * @param out   At least ESCAPE_MAX(len + sizeof(ELLIPSIS)) + 1 bytes
+ * @param width Set to the display width of the text as displayed (0 without --max-width)
+ * @return Length of the rendered text
+ */
+static size_t render_text(const char *text, size_t len, char *out, size_t *width)
+{
+    char fitted[TRACK_CACHE_SIZE + sizeof(STALE_MARKER) + sizeof(ELLIPSIS)];
+
+    *width = 0;
+    if (max_width > 0 && len < sizeof(fitted) - sizeof(ELLIPSIS)) {
+        len = truncate_text(text, len, max_width, fitted, width);
+        text = fitted;
+    }
+    switch (output_format) {
+        case FORMAT_JSON:
+            return json_escape(text, len, out);
+        case FORMAT_PANGO:
+            return pango_escape(text, len, out);
+        case FORMAT_TEXT:
+            break;
+    }
+    memcpy(out, text, len);
+    out[len] = '\0';
+    return len;
+}
+
+/**
+ * Writes an i3bar/waybar block (one JSON object per line) from already escaped texts
+ *
+ * Both full_text (i3bar, i3blocks) and text (waybar) carry the full text.
+ */
+static void output_json_block(Output *out, const char *fullText, size_t fullLength,
+                              const char *shortText, size_t shortLength, const StatusStyle *style)
+{
+    output_str(out, "{\"full_text\":\"");
+    output_bytes(out, fullText, fullLength);
+    output_str(out, "\",\"short_text\":\"");
+    output_bytes(out, shortText, shortLength);
+    output_str(out, "\",\"text\":\"");
+    output_bytes(out, fullText, fullLength);
+    if (style->color != NULL) {
+        output_str(out, "\",\"color\":\"");
+        output_str(out, style->color);
+    }
+    output_str(out, "\",\"class\":\"");
+    output_str(out, style->className);
+    output_str(out, "\"}\n");
+}
+
+/**
+ * Renders a track in the selected output format: its line as is or escaped for Pango, or a
+ * JSON block; cut to --max-width columns if set
+ *
+ * @param line      "[ARTIST] - [TITLE]" line built by format_track
+ * @param status    PlaybackStatus (only used for FORMAT_JSON)
+ */
+static void output_track_line(Output *out, const TrackInfo *info, const char *line, const char *status)
+{
+    RenderedTrackCache *cache = &rendered_track_cache;
+
+    if (output_format == FORMAT_TEXT && max_width == 0) {
+        output_str(out, line);
+        return;
+    }
+
+    // The title alone is needed too: "A - B" + "C" & "A" + "B - C" make the same line
+    if (strcmp(cache->line, line) != 0 || strcmp(cache->title, info->title) != 0) {
+        snprintf(cache->line, sizeof(cache->line), "%s", line);
+        snprintf(cache->title, sizeof(cache->title), "%s", info->title);
+        cache->fullLength = render_text(line, strlen(line), cache->fullText, &cache->fullWidth);
+        cache->shortLength = render_text(info->title, strlen(info->title), cache->shortText, &cache->shortWidth);
+    }
+    if (output_format != FORMAT_JSON) {
+        output_bytes(out, cache->fullText, cache->fullLength);
+        return;
+    }
+    output_json_block(out, cache->fullText, cache->fullLength, cache->shortText, cache->shortLength,
+                      status_style(status));
+}
+
+/**
+ * Renders the last known track line read from the on-disk cache, marked as stale
+ */
+static void output_stale_line(Output *out, const char *line)
+{
+    char stale[TRACK_CACHE_SIZE + sizeof(STALE_MARKER)];
+    char escaped[ESCAPE_MAX(sizeof(stale) + sizeof(ELLIPSIS)) + 1];
+    size_t length, width;
+
+    snprintf(stale, sizeof(stale), "%s" STALE_MARKER, line);
+    length = render_text(stale, strlen(stale), escaped, &width);
+    if (output_format != FORMAT_JSON) {
+        output_bytes(out, escaped, length);
+        return;
+    }
+    output_json_block(out, escaped, length, escaped, length, &stale_status_style);
+}
+
+/**
+ * Prints a fetched track (see command_track)
+ *
+ * @param status    PlaybackStatus (only used for FORMAT_JSON)
+ */
+static SpotifyError output_track(SpotifyError err, const TrackInfo *info, const char *status, DBusError *error)
+{
+    char line[TRACK_CACHE_SIZE];
+
+    if (err == SPOTIFY_TIMEOUT && read_track_cache(line, sizeof(line))) {
+        dbus_error_free(error);
+        output_stale_line(&stdout_output, line);
+        output_flush(&stdout_output);
+        return SPOTIFY_OK;
+    }
+    if (err != SPOTIFY_OK) {
+        return check_error(error);
+    }
+
+    err = format_track(info, line, sizeof(line));
+    if (err != SPOTIFY_OK) {
+        fprintf(stderr, "Could not read artist/track metadata.\n");
+    } else {
+        output_track_line(&stdout_output, info, line, status);
+        output_flush(&stdout_output);
+        write_track_cache(line);
+    }
+
+    return err;
+}
+
+/**
+ * `track` command: prints out "[ARTIST] - [TITLE]" (typically for i3 status bar usage), or
+ * an i3bar/waybar JSON block styled after the PlaybackStatus with --json
+ *
+ * If Spotify does not answer within the call deadline, the last known track is printed from
+ * the on-disk cache with STALE_MARKER appended, so that the status bar never hangs.
+ */
+SpotifyError command_track(Backend *backend, DBusError *error)
+{
+    TrackInfo info;
+    char status[PLAYBACK_STATUS_SIZE] = "";
+    SpotifyError err = get_track_info(backend, &info, error);
+
+    if (err == SPOTIFY_OK && output_format == FORMAT_JSON) {
+        get_playback_status(backend, status, sizeof(status));
+    }
+    return output_track(err, &info, status, error);
+}
+
+/**
+ * `track` command served by the wire client (see get_track_info_wire)
+ *
+ * @return 1 if the command was handled (its outcome stored in `result`), 0 if libdbus is needed
+ */
+int command_track_wire(DBusError *error, SpotifyError *result)
+{
+    TrackInfo info;
+    SpotifyError err;
+
+    if (!get_track_info_wire(&info, &err, error)) {
+        return 0;
+    }
+    *result = output_track(err, &info, "", error);
+    return 1;
+}
+
+SpotifyError command_play_pause(Backend *backend, DBusError *error)
+{
+    if (call_player_method(backend, "PlayPause", error) != SPOTIFY_OK) {
+        return check_error(error);
+    }
+    return SPOTIFY_OK;
+}
+
+/**
+ * Sends a net skip count as back-to-back Next (positive) or Previous (negative) calls
+ */
+static SpotifyError send_skips(Backend *backend, double count, DBusError *error)
+{
+    const char *method = count > 0 ? "Next" : "Previous";
+    long skips = (long)(count > 0 ? count : -count);
+    SpotifyError err = SPOTIFY_OK;
+
+    for (long i = 0; i < skips && err == SPOTIFY_OK; ++i) {
+        err = call_player_method(backend, method, error);
+    }
+    return err;
+}
+
+/**
+ * Skips to next or previous track
+ *
+ * Presses are queued through coalesce_delta: the first one is sent right away, and the ones
+ * following it within the coalescing window are merged into a count sent back-to-back on the
+ * leader's connection. Skips thus stay bounded in latency under key repeat instead of landing
+ * long after the key was released. Next & Previous are queued separately: they do not cancel
+ * each other out (Previous past the first seconds of a track restarts it).
+ */
+SpotifyError command_next_or_prev(NextOrPrev go_next, Backend *backend, DBusError *error)
+{
+    if (coalesce_delta(go_next == NEXT ? "skip-next" : "skip-prev", go_next == NEXT ? 1 : -1, send_skips, backend,
+                       error) != SPOTIFY_OK) {
+        return check_error(error);
+    }
+    return SPOTIFY_OK;
+}
+
+/**
+ * `seek` command: moves the playback position by ±N seconds
+ */
+SpotifyError command_seek(const char *offset, Backend *backend, DBusError *error)
+{
+    double seconds;
+
+    if (!parse_amount(offset, &seconds, NULL)) {
+        fprintf(stderr, "ERROR: seek expects an offset in seconds (e.g. +10, -5)\n");
+        return SPOTIFY_BAD_ARGUMENT;
+    }
+    if (coalesce_delta("seek", seconds, send_seek, backend, error) != SPOTIFY_OK) {
+        return check_error(error);
+    }
+    return SPOTIFY_OK;
+}
+
+/**
+ * `position` command: jumps to T seconds into the current track
+ */
+SpotifyError command_position(const char *position, Backend *backend, DBusError *error)
+{
+    DBusMessage *msg;
+    TrackInfo info;
+    SpotifyError err;
+    double seconds;
+
+    if (!parse_amount(position, &seconds, NULL) || seconds < 0) {
+        fprintf(stderr, "ERROR: position expects a number of seconds\n");
+        return SPOTIFY_BAD_ARGUMENT;
+    }
+
+    // SetPosition is ignored unless it names the current track
+    if (get_track_info(backend, &info, error) != SPOTIFY_OK) {
+        return check_error(error);
+    }
+    if (!TRACK_HAS(&info, trackid) || !dbus_validate_path(info.trackid, NULL)) {
+        fprintf(stderr, "Could not read the current track id.\n");
+        return SPOTIFY_NO_METADATA;
+    }
+
+    const char *trackId = info.trackid;
+    dbus_int64_t positionUs = (dbus_int64_t)(seconds * SEEK_UNIT_US);
+    msg = dbus_message_new_method_call(player_destination(), MPRIS_PATH, MPRIS_PLAYER_INTERFACE, "SetPosition");
+    if (msg == NULL || !dbus_message_append_args(msg,
+            DBUS_TYPE_OBJECT_PATH, &trackId,
+            DBUS_TYPE_INT64, &positionUs,
+            DBUS_TYPE_INVALID)) {
+        dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, "DBusMessage was NULL");
+        err = SPOTIFY_NO_MEMORY;
+    } else {
+        err = send_player_control(backend, msg, error);
+    }
+    if (msg != NULL) {
+        dbus_message_unref(msg);
+    }
+
+    return err != SPOTIFY_OK ? check_error(error) : SPOTIFY_OK;
+}
+
+/**
+ * `volume` command: sets the volume to N percent, or changes it by ±N percent points
+ */
+SpotifyError command_volume(const char *amount, Backend *backend, DBusError *error)
+{
+    double percent;
+    int isRelative;
+    SpotifyError err;
+
+    if (!parse_amount(amount, &percent, &isRelative)) {
+        fprintf(stderr, "ERROR: volume expects a percentage (e.g. 50, +5, -5)\n");
+        return SPOTIFY_BAD_ARGUMENT;
+    }
+    if (isRelative) {
+        err = coalesce_delta("volume", percent, send_volume_step, backend, error);
+    } else {
+        err = set_volume(backend, percent / 100.0, error);
+    }
+    return err != SPOTIFY_OK ? check_error(error) : SPOTIFY_OK;
+}
+
+SpotifyError command_metadata(Backend *backend, DBusError *error)
+{
+    MetadataArray metadata;
+
+    init_metadata_array(&metadata);
+    if (get_dbus_metadata(backend, &metadata, error) != SPOTIFY_OK) {
+        return check_error(error);
+    }
+    print_metadata_array(&metadata, &stdout_output);
+    output_flush(&stdout_output);
+    free_metadata_array(&metadata);
+    return SPOTIFY_OK;
+}
+
+/**
+ * Records a change of a PlayerState field (a TrackField, or PLAYER_STATUS_FIELD)
+ */
+static void touch_player_field(PlayerState *state, uint32_t field)
+{
+    state->fieldGeneration[field] = ++state->generation;
+}
+
+/**
+ * Whether any of the fields in `mask` (PLAYER_FIELD_BIT bits) changed after generation `since`
+ */
+static int player_fields_changed(const PlayerState *state, uint32_t mask, uint64_t since)
+{
+    for (uint32_t i = 0; i < PLAYER_FIELD_COUNT; ++i) {
+        if ((mask & PLAYER_FIELD_BIT(i)) != 0 && state->fieldGeneration[i] > since) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Fields rendered by format_track
+#define TRACK_LINE_FIELDS (PLAYER_FIELD_BIT(TRACK_FIELD_artist) | PLAYER_FIELD_BIT(TRACK_FIELD_title))
+
+/**
+ * Fingerprint (XXH64) of the values of the fields in `mask`: the fields an output depends on,
+ * so that an update leaving its fingerprint as is can skip rendering & writing altogether
+ */
+static uint64_t player_fingerprint(const PlayerState *state, uint32_t mask)
+{
+    const TrackInfo *info = &state->track;
+    uint64_t hash = 0;
+
+    for (uint32_t i = 0; i < TRACK_FIELD_COUNT; ++i) {
+        const char *value = (const char*)info + track_schema[i].offset;
+
+        if ((mask & PLAYER_FIELD_BIT(i)) == 0) {
+            continue;
+        }
+        if ((info->present & (1u << i)) == 0) {
+            // Not the same as any value, even an empty one
+            hash = xxh64("", 0, ~hash);
+            continue;
+        }
+        switch (track_schema[i].kind) {
+            case FIELD_STRING:
+            case FIELD_FIRST_STRING:
+                hash = xxh64(value, strlen(value), hash);
+                break;
+            case FIELD_INT64:
+                hash = xxh64(value, sizeof(int64_t), hash);
+                break;
+            case FIELD_INT32:
+                hash = xxh64(value, sizeof(int32_t), hash);
+                break;
+        }
+    }
+    if ((mask & PLAYER_FIELD_BIT(PLAYER_STATUS_FIELD)) != 0) {
+        hash = xxh64(state->status, strlen(state->status), hash);
+    }
+    return hash;
+}
+
+/**
+ * Whether a TrackInfo string field holds `str`, as copy_track_string would store it
+ */
+static int track_string_equals(const char *stored, const char *str)
+{
+    char copy[TRACK_STRING_SIZE];
+    size_t len = strlen(stored);
+
+    if (strncmp(stored, str, len) != 0) {
+        return 0;
+    }
+    if (str[len] == '\0') {
+        return 1;
+    }
+    // Longer than the field: equal if it was cut at that same point
+    copy_track_string(copy, str);
+    return strcmp(copy, stored) == 0;
+}
+
+/**
+ * Compares a metadata value with the stored TrackInfo field, without decoding it into the field
+ * (strings are compared in place in the message)
+ *
+ * @return 1 if the field is present & holds that very value
+ */
+static int track_field_unchanged(const TrackInfo *info, uint32_t field, DBusMessageIter *value)
+{
+    const TrackFieldSpec *spec = &track_schema[field];
+    const char *stored = (const char*)info + spec->offset;
+    DBusMessageIter sub;
+    const char *str;
+    int64_t integer;
+
+    if ((info->present & (1u << field)) == 0) {
+        return 0;
+    }
+    switch (spec->kind) {
+        case FIELD_FIRST_STRING:
+            if (dbus_message_iter_get_arg_type(value) != DBUS_TYPE_ARRAY) {
+                return 0;
+            }
+            dbus_message_iter_recurse(value, &sub);
+            value = &sub;
+            // fall through
+        case FIELD_STRING:
+            if (!is_string_type(dbus_message_iter_get_arg_type(value))) {
+                return 0;
+            }
+            dbus_message_iter_get_basic(value, &str);
+            return track_string_equals(stored, str);
+        case FIELD_INT64:
+            return read_integer(value, &integer) && *(const int64_t*)stored == integer;
+        case FIELD_INT32:
+            return read_integer(value, &integer) && *(const int32_t*)stored == (int32_t)integer;
+    }
+    return 0;
+}
+
+/**
+ * Resets a TrackInfo field to its value in a fresh TrackInfo (see init_track_info)
+ */
+static void clear_track_field(TrackInfo *info, const TrackFieldSpec *spec)
+{
+    char *field = (char*)info + spec->offset;
+
+    switch (spec->kind) {
+        case FIELD_STRING:
+        case FIELD_FIRST_STRING:
+            field[0] = '\0';
+            break;
+        case FIELD_INT64:
+            *(int64_t*)field = 0;
+            break;
+        case FIELD_INT32:
+            *(int32_t*)field = 0;
+            break;
+    }
+}
+
+/**
+ * Merges a complete Metadata dict (from a Get reply or a PropertiesChanged signal) into the
+ * player state in place: only the fields whose value differs are decoded & stored, and have
+ * their generation bumped; fields missing from the dict are cleared
+ */
+static void apply_track_entries(PlayerState *state, DBusMessageIter *entries)
+{
+    TrackInfo *info = &state->track;
+    DBusMessageIter value;
+    const char *key;
+    uint32_t seen = 0;
+
+    while (next_dict_entry(entries, &key, &value)) {
+        for (uint32_t i = 0; i < TRACK_FIELD_COUNT; ++i) {
+            if (strcmp(track_schema[i].key, key) != 0) {
+                continue;
+            }
+            if (track_field_unchanged(info, i, &value)) {
+                seen |= 1u << i;
+            } else if (decode_track_field(info, &track_schema[i], &value)) {
+                info->present |= 1u << i;
+                seen |= 1u << i;
+                touch_player_field(state, i);
+            }
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < TRACK_FIELD_COUNT; ++i) {
+        if ((info->present & ~seen & (1u << i)) != 0) {
+            clear_track_field(info, &track_schema[i]);
+            info->present &= ~(1u << i);
+            touch_player_field(state, i);
+        }
+    }
+    state->hasTrack = 1;
+}
+
+static void set_player_status(PlayerState *state, const char *status)
+{
+    char fresh[PLAYBACK_STATUS_SIZE];
+
+    snprintf(fresh, sizeof(fresh), "%s", status);
+    if (strcmp(fresh, state->status) != 0) {
+        memcpy(state->status, fresh, sizeof(fresh));
+        touch_player_field(state, PLAYER_STATUS_FIELD);
+    }
+}
+
+/**
+ * Applies a PropertiesChanged signal of the Player interface (see player_properties_changed) to
+ * the player state: new Metadata & PlaybackStatus values are merged in place, without a Get
+ *
+ * @return 1 if one of them was invalidated instead (sent without its value) & must be re-read
+ */
+static int apply_player_properties(PlayerState *state, DBusMessage *msg)
+{
+    DBusMessageIter args, list, value, entries;
+    const char *name;
+    int reread = 0;
+
+    // Interface name, then changed properties (a{sv}) & invalidated ones (as)
+    if (!dbus_message_iter_init(msg, &args) || !dbus_message_iter_next(&args)
+            || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY) {
+        return 1;
+    }
+    dbus_message_iter_recurse(&args, &list);
+    while (next_dict_entry(&list, &name, &value)) {
+        if (strcmp(name, "Metadata") == 0 && dbus_message_iter_get_arg_type(&value) == DBUS_TYPE_ARRAY) {
+            dbus_message_iter_recurse(&value, &entries);
+            alloc_stats_begin();
+            apply_track_entries(state, &entries);
+            alloc_stats_report("decode (signal)");
+        } else if (state->wantStatus && strcmp(name, "PlaybackStatus") == 0
+                && dbus_message_iter_get_arg_type(&value) == DBUS_TYPE_STRING) {
+            dbus_message_iter_get_basic(&value, &name);
+            set_player_status(state, name);
+        }
+    }
+
+    if (dbus_message_iter_next(&args) && dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_ARRAY) {
+        dbus_message_iter_recurse(&args, &list);
+        while (dbus_message_iter_get_arg_type(&list) == DBUS_TYPE_STRING) {
+            dbus_message_iter_get_basic(&list, &name);
+            reread |= strcmp(name, "Metadata") == 0 || (state->wantStatus && strcmp(name, "PlaybackStatus") == 0);
+            dbus_message_iter_next(&list);
+        }
+    }
+    return reread;
+}
+
+/**
+ * Re-reads the metadata of a PlayerState from Spotify, merged into it like a PropertiesChanged
+ * delta (see apply_track_entries)
+ *
+ * Errors are reported but never fatal: the previously cached metadata is kept as is, and a
+ * ServiceUnknown error simply marks Spotify as not running.
+ */
+SpotifyError refresh_player_state(PlayerState *state, DBusError *error)
+{
+    DBusMessage *reply;
+    DBusMessageIter entries;
+    char status[PLAYBACK_STATUS_SIZE];
+
+    alloc_stats_begin();
+    reply = get_metadata_entries(state->backend, &entries, error);
+    if (reply != NULL) {
+        apply_track_entries(state, &entries);
+        dbus_message_unref(reply);
+    }
+    alloc_stats_report("decode");
+    if (reply == NULL) {
+        if (classify_error(error) == SPOTIFY_NOT_RUNNING) {
+            state->running = 0;
+            dbus_error_free(error);
+            return SPOTIFY_NOT_RUNNING;
+        }
+        return check_error(error);
+    }
+    state->running = 1;
+    if (state->wantStatus) {
+        get_playback_status(state->backend, status, sizeof(status));
+        set_player_status(state, status);
+    }
+    return SPOTIFY_OK;
+}
+
+/**
+ * Points the PropertiesChanged match rule at Spotify's current unique name (see resolve_player),
+ * replacing the rule of a previous instance. No rule is installed while Spotify is not running.
+ *
+ * @return 1 on success, 0 with `error` set otherwise
+ */
+static int subscribe_player_changes(PlayerState *state, DBusError *error)
+{
+    Backend *backend = state->backend;
+    char rule[PLAYER_RULE_SIZE] = "";
+
+    if (player_owner[0] != '\0') {
+        snprintf(rule, sizeof(rule), PLAYER_PROPERTIES_CHANGED_RULE "'%s'", player_owner);
+    }
+    if (strcmp(rule, state->subscribedRule) == 0) {
+        return 1;
+    }
+    if (state->subscribedRule[0] != '\0') {
+        backend->ops->unsubscribe(backend, state->subscribedRule);
+        state->subscribedRule[0] = '\0';
+    }
+    if (rule[0] != '\0' && !backend->ops->subscribe(backend, rule, error)) {
+        return 0;
+    }
+    memcpy(state->subscribedRule, rule, sizeof(rule));
+    return 1;
+}
+
+/**
+ * Early filter for the PropertiesChanged signals of the Player interface: reads the names of the
+ * changed & invalidated properties only, without decoding any value
+ *
+ * @return 1 if Metadata (or PlaybackStatus, when tracked) changed, 0 if the signal can be ignored
+ */
+static int player_properties_changed(const PlayerState *state, DBusMessage *msg)
+{
+    DBusMessageIter args, list, entry;
+    const char *name;
+
+    if (!dbus_message_iter_init(msg, &args) || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_STRING) {
+        return 0;
+    }
+    dbus_message_iter_get_basic(&args, &name);
+    if (strcmp(name, MPRIS_PLAYER_INTERFACE) != 0) {
+        return 0;
+    }
+
+    // Changed properties (a{sv}), then invalidated ones (as)
+    for (int i = 0; i < 2 && dbus_message_iter_next(&args); ++i) {
+        if (dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY) {
+            return 0;
+        }
+        dbus_message_iter_recurse(&args, &list);
+        while (dbus_message_iter_get_arg_type(&list) != DBUS_TYPE_INVALID) {
+            if (dbus_message_iter_get_arg_type(&list) == DBUS_TYPE_DICT_ENTRY) {
+                dbus_message_iter_recurse(&list, &entry);
+            } else {
+                entry = list;
+            }
+            if (dbus_message_iter_get_arg_type(&entry) == DBUS_TYPE_STRING) {
+                dbus_message_iter_get_basic(&entry, &name);
+                if (strcmp(name, "Metadata") == 0 || (state->wantStatus && strcmp(name, "PlaybackStatus") == 0)) {
+                    return 1;
+                }
+            }
+            dbus_message_iter_next(&list);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Appends a string then a decimal number to a line being built by report_signal_stats
+ */
+static char *append_stat(char *p, const char *text, uint64_t value)
+{
+    char digits[20];
+    int n = 0;
+
+    while (*text != '\0') {
+        *p++ = *text++;
+    }
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+/**
+ * SIGUSR1 handler: writes the SignalStats to stderr, with async-signal-safe calls only (the
+ * process is usually blocked inside libdbus, which retries its poll on EINTR)
+ */
+static void report_signal_stats(int sig)
+{
+    char line[192], *p = line;
+
+    (void)sig;
+    p = append_stat(p, "signals: ", signal_stats.wakeups);
+    p = append_stat(p, " wakeups, ", signal_stats.updates);
+    p = append_stat(p, " updates, ", signal_stats.skipped);
+    p = append_stat(p, " skipped; output: ", signal_stats.emitted);
+    p = append_stat(p, " emitted, ", signal_stats.unchanged);
+    memcpy(p, " unchanged\n", 11);
+    p += 11;
+    if (write(STDERR_FILENO, line, (size_t)(p - line)) < 0) {
+        return;
+    }
+}
+
+/**
+ * Handles a NameOwnerChanged signal for Spotify's bus name
+ *
+ * @return 1 if Spotify (re)appeared on the bus & the state must be refreshed, 0 otherwise
+ */
+int handle_name_owner_changed(PlayerState *state, DBusMessage *msg)
+{
+    const char *name, *oldOwner, *newOwner;
+
+    if (!dbus_message_get_args(msg, NULL,
+            DBUS_TYPE_STRING, &name,
+            DBUS_TYPE_STRING, &oldOwner,
+            DBUS_TYPE_STRING, &newOwner,
+            DBUS_TYPE_INVALID)
+            || strcmp(name, SPOTIFY_BUS_NAME) != 0) {
+        return 0;
+    }
+    set_player_owner(newOwner);
+    state->running = newOwner[0] != '\0';
+
+    DBusError error;
+    dbus_error_init(&error);
+    if (!subscribe_player_changes(state, &error)) {
+        check_error(&error);
+    }
+    return state->running;
+}
+
+/**
+ * Starts tracking Spotify for a resident command: resolves its bus name & subscribes to its
+ * property changes
+ *
+ * @return SPOTIFY_OK when watching (even if Spotify is not running yet), or the error reported
+ */
+static SpotifyError watch_player(PlayerState *state, Backend *backend, DBusError *error)
+{
+    state->backend = backend;
+    state->running = 0;
+    state->hasTrack = 0;
+    state->wantStatus = output_format == FORMAT_JSON;
+    state->status[0] = '\0';
+    state->generation = 0;
+    memset(state->fieldGeneration, 0, sizeof(state->fieldGeneration));
+    state->subscribedRule[0] = '\0';
+    init_track_info(&state->track);
+
+    if (resolve_player(backend, error) != SPOTIFY_OK && !watching_player_owner) {
+        return check_error(error);
+    }
+    dbus_error_free(error);
+    if (!subscribe_player_changes(state, error)) {
+        return check_error(error);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = report_signal_stats;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+    return SPOTIFY_OK;
+}
+
+/**
+ * Handles the signals received from the bus, waiting up to `timeoutMs` for the first one, until
+ * the player state changed or must be re-read
+ *
+ * A track change usually comes as a burst of signals a few milliseconds apart, some of them
+ * inconsistent (new title, old artist): after the first change, signals keep being applied for
+ * settle_window_ms, so that the caller only sees the settled state.
+ *
+ * The changes applied before the connection closed (or the capture ended) are kept: callers
+ * render them before giving up.
+ *
+ * @param refresh   Set to 1 when the player state must be re-read
+ * @return BACKEND_CLOSED if the bus connection is gone, BACKEND_END at the end of a replayed
+ *         capture, BACKEND_IDLE otherwise
+ */
+static BackendEvent handle_player_signals(PlayerState *state, int timeoutMs, int *refresh)
+{
+    Backend *backend = state->backend;
+    uint64_t generation = state->generation, settled = 0;
+    DBusMessage *msg;
+    BackendEvent event;
+
+    while (1) {
+        int pending = *refresh || state->generation != generation;
+        int waitMs = timeoutMs;
+
+        if (pending) {
+            uint64_t now = monotonic_ns();
+
+            if (settled == 0) {
+                settled = now + (uint64_t)settle_window_ms * 1000000;
+            }
+            // Rounded up, so that the window is not cut short
+            waitMs = now < settled ? (int)((settled - now + 999999) / 1000000) : 0;
+        }
+        event = backend->ops->dispatch(backend, waitMs, &msg);
+        if (event != BACKEND_MESSAGE) {
+            // Done once the window is over (backends without an fd never block: no window)
+            if (event != BACKEND_IDLE || !pending || waitMs == 0 || backend->ops->poll_fd(backend) < 0) {
+                return event;
+            }
+            continue;
+        }
+
+        signal_stats.wakeups++;
+        if (dbus_message_is_signal(msg, "org.freedesktop.DBus", "NameOwnerChanged")) {
+            *refresh |= handle_name_owner_changed(state, msg);
+        } else if (dbus_message_is_signal(msg, "org.freedesktop.DBus.Properties", "PropertiesChanged")) {
+            if (player_properties_changed(state, msg)) {
+                signal_stats.updates++;
+                *refresh |= apply_player_properties(state, msg);
+            } else {
+                signal_stats.skipped++;
+            }
+        }
+        dbus_message_unref(msg);
+    }
+}
+
+/**
+ * `follow` command: resident mode printing "[ARTIST] - [TITLE]" lines (i3blocks "persist"
+ * interval) whenever Spotify reports a property change.
+ *
+ * The bus connection is kept for the whole process lifetime; Spotify quitting or restarting
+ * is tracked through NameOwnerChanged, and the last known track is kept in the meantime.
+ */
+SpotifyError command_follow(Backend *backend, DBusError *error)
+{
+    PlayerState state;
+    char line[TRACK_CACHE_SIZE];
+    uint64_t rendered = 0, fingerprint = 0;
+    uint32_t fields;
+    BackendEvent event = BACKEND_IDLE;
+
+    if (watch_player(&state, backend, error) != SPOTIFY_OK) {
+        return classify_error(error);
+    }
+    fields = TRACK_LINE_FIELDS | (state.wantStatus ? PLAYER_FIELD_BIT(PLAYER_STATUS_FIELD) : 0);
+
+    int refresh = player_owner[0] != '\0';
+    while (1) {
+        if (refresh) {
+            refresh_player_state(&state, error);
+            refresh = 0;
+        }
+        // Only print when a signal changed something since the last line, and something shown
+        if (state.hasTrack && state.generation != rendered) {
+            uint64_t fresh = player_fingerprint(&state, fields);
+
+            rendered = state.generation;
+            if (fresh == fingerprint) {
+                signal_stats.unchanged++;
+            } else if (format_track(&state.track, line, sizeof(line)) == SPOTIFY_OK) {
+                signal_stats.emitted++;
+                fingerprint = fresh;
+                output_track_line(&stdout_output, &state.track, line, state.status);
+                if (output_format != FORMAT_JSON) {
+                    output_char(&stdout_output, '\n');
+                }
+                output_flush(&stdout_output);
+                write_track_cache(line);
+            }
+        }
+
+        // Stops once the last changes received are printed
+        if (event == BACKEND_END) {
+            dbus_error_free(error);
+            return SPOTIFY_OK;
+        }
+        if (event == BACKEND_CLOSED) {
+            // The bus itself went away: nothing left to follow
+            dbus_set_error_const(error, DBUS_ERROR_DISCONNECTED, "Disconnected from the session bus");
+            return check_error(error);
+        }
+        event = handle_player_signals(&state, -1, &refresh);
+    }
+}
+
+#define MARQUEE_TEXT_SIZE (TRACK_CACHE_SIZE + sizeof(MARQUEE_GAP))
+
+/**
+ * Scrolling text of `track --marquee`: the track line followed by MARQUEE_GAP, looped. It is split
+ * into grapheme clusters once per track, so that a tick only copies the clusters of its window.
+ */
+typedef struct {
+    char text[MARQUEE_TEXT_SIZE];
+    size_t lineLength;
+    size_t lineWidth;
+    uint32_t clusterCount;
+    uint32_t offset;                // First cluster of the current window
+    uint16_t clusterStart[MARQUEE_TEXT_SIZE + 1];
+    uint8_t clusterWidth[MARQUEE_TEXT_SIZE];
+} Marquee;
+
+static Marquee marquee;
+
+/**
+ * Loads the line of a track into the marquee, unless it already shows that very line (compared
+ * by content: Spotify may update the metadata of a track without changing its trackid)
+ */
+static void set_marquee_track(Marquee *m, const char *line)
+{
+    size_t length = strlen(line), pos = 0, width;
+
+    if (m->clusterCount != 0 && length == m->lineLength && memcmp(m->text, line, length) == 0) {
+        return;
+    }
+    m->lineLength = length;
+    length = (size_t)snprintf(m->text, sizeof(m->text), "%s" MARQUEE_GAP, line);
+    m->lineWidth = 0;
+    m->clusterCount = 0;
+    m->offset = 0;
+    while (pos < length) {
+        m->clusterStart[m->clusterCount] = (uint16_t)pos;
+        pos = grapheme_cluster_end(m->text, length, pos, &width);
+        m->clusterWidth[m->clusterCount++] = (uint8_t)width;
+        if (pos <= m->lineLength) {
+            m->lineWidth += width;
+        }
+    }
+    m->clusterStart[m->clusterCount] = (uint16_t)length;
+}
+
+/**
+ * Writes the `columns`-wide window of the marquee starting at its current offset (or the whole
+ * line if it fits) in the selected output format, one line per window
+ */
+static void output_marquee_window(Output *out, const Marquee *m, size_t columns, const char *status)
+{
+    char window[MARQUEE_TEXT_SIZE + 2];
+    char escaped[ESCAPE_MAX(sizeof(window)) + 1];
+    size_t length = 0, used = 0;
+
+    if (m->lineWidth <= columns) {
+        memcpy(window, m->text, m->lineLength);
+        length = m->lineLength;
+    } else {
+        // Less than a full loop, as the line alone is wider than the window
+        for (uint32_t i = m->offset; used + m->clusterWidth[i] <= columns; i = (i + 1) % m->clusterCount) {
+            size_t clusterLength = m->clusterStart[i + 1] - m->clusterStart[i];
+            memcpy(window + length, m->text + m->clusterStart[i], clusterLength);
+            length += clusterLength;
+            used += m->clusterWidth[i];
+        }
+        // A wide character that did not fit at the edge: keep the width constant
+        for (; used < columns; used++) {
+            window[length++] = ' ';
+        }
+    }
+
+    switch (output_format) {
+        case FORMAT_TEXT:
+            output_bytes(out, window, length);
+            break;
+        case FORMAT_PANGO:
+            output_bytes(out, escaped, pango_escape(window, length, escaped));
+            break;
+        case FORMAT_JSON:
+            length = json_escape(window, length, escaped);
+            output_json_block(out, escaped, length, escaped, length, status_style(status));
+            return;
+    }
+    output_char(out, '\n');
+}
+
+/**
+ * Starts the marquee timer with the given period, or stops it with 0
+ */
+static void set_marquee_timer(int timerFd, long periodNs)
+{
+    struct itimerspec spec;
+
+    spec.it_interval.tv_sec = periodNs / 1000000000L;
+    spec.it_interval.tv_nsec = periodNs % 1000000000L;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(timerFd, 0, &spec, NULL);
+}
+
+/**
+ * `track --marquee WIDTH [--speed HZ]` command: resident mode (i3blocks "persist" interval)
+ * printing a WIDTH-column window of the "[ARTIST] - [TITLE]" line, shifted by one grapheme
+ * cluster HZ times per second.
+ *
+ * The timerfd only runs while the line is wider than the window & Spotify is playing: otherwise
+ * the line is printed once per change, and the process sleeps until the next signal.
+ */
+SpotifyError command_marquee(int argc, char *argv[], Backend *backend, DBusError *error)
+{
+    PlayerState state;
+    Marquee *m = &marquee;
+    char line[TRACK_CACHE_SIZE];
+    size_t columns = 0;
+    double hz = DEFAULT_MARQUEE_HZ;
+    int timerFd, ticking = 0;
+    uint64_t rendered = 0, fingerprint = 0;
+    BackendEvent event = BACKEND_IDLE;
+
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--marquee") == 0 && i + 1 < argc) {
+            int width = atoi(argv[++i]);
+            columns = width > 0 ? (size_t)width : 0;
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            hz = atof(argv[++i]);
+        } else {
+            columns = 0;
+            break;
+        }
+    }
+    if (columns == 0 || !(hz > 0 && hz <= 1000)) {
+        fprintf(stderr, "ERROR: usage: track --marquee WIDTH [--speed HZ]\n");
+        return SPOTIFY_BAD_ARGUMENT;
+    }
+
+    if (watch_player(&state, backend, error) != SPOTIFY_OK) {
+        return classify_error(error);
+    }
+    state.wantStatus = 1;
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timerFd < 0) {
+        perror("ERROR: timerfd_create");
+        return SPOTIFY_DBUS_ERROR;
+    }
+
+    int refresh = player_owner[0] != '\0';
+    while (1) {
+        struct pollfd fds[2];
+        uint64_t ticks;
+
+        if (refresh) {
+            refresh_player_state(&state, error);
+            refresh = 0;
+        }
+        if (state.hasTrack && state.generation != rendered) {
+            uint64_t fresh = player_fingerprint(&state, TRACK_LINE_FIELDS | PLAYER_FIELD_BIT(PLAYER_STATUS_FIELD));
+
+            rendered = state.generation;
+            if (fresh == fingerprint) {
+                signal_stats.unchanged++;
+            } else if (format_track(&state.track, line, sizeof(line)) == SPOTIFY_OK) {
+                signal_stats.emitted++;
+                fingerprint = fresh;
+                set_marquee_track(m, line);
+                output_marquee_window(&stdout_output, m, columns, state.status);
+                output_flush(&stdout_output);
+                write_track_cache(line);
+            }
+        }
+
+        // Stops once the last changes received are shown
+        if (event == BACKEND_END) {
+            break;
+        }
+        if (event == BACKEND_CLOSED) {
+            dbus_set_error_const(error, DBUS_ERROR_DISCONNECTED, "Disconnected from the session bus");
+            break;
+        }
+
+        int scroll = state.running && m->lineWidth > columns && strcmp(state.status, "Playing") == 0;
+        if (scroll != ticking) {
+            set_marquee_timer(timerFd, scroll ? (long)(1e9 / hz) : 0);
+            ticking = scroll;
+        }
+
+        // Messages read while blocked in a method call (refresh_player_state) wait in the
+        // backend's queue, where poll cannot see them: drain it before sleeping
+        uint64_t generation = state.generation;
+        event = handle_player_signals(&state, 0, &refresh);
+        if (event != BACKEND_IDLE || refresh || state.generation != generation) {
+            continue;
+        }
+
+        // Sleeps until the next message or tick (poll skips the fd of a backend without one)
+        fds[0].fd = backend->ops->poll_fd(backend);
+        fds[0].events = POLLIN;
+        fds[1].fd = timerFd;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            break;
+        }
+
+        if ((fds[1].revents & POLLIN) && read(timerFd, &ticks, sizeof(ticks)) == sizeof(ticks) && ticking) {
+            // Ticks missed while busy are caught up on, so that the speed stays constant
+            m->offset = (uint32_t)((m->offset + ticks) % m->clusterCount);
+            output_marquee_window(&stdout_output, m, columns, state.status);
+            output_flush(&stdout_output);
+        }
+    }
+
+    close(timerFd);
+    return check_error(error);
+}
+
+/**
+ * Records the current reply to a Player property read into a capture file
+ */
+static SpotifyError record_property(FILE *file, Backend *backend, const char *property, DBusError *error)
+{
+    DBusMessageIter value;
+    DBusMessage *reply = get_player_property(backend, property, &value, error);
+    int written;
+
+    if (reply == NULL) {
+        return check_error(error);
+    }
+    written = capture_write_record(file, CAPTURE_PROPERTY_REPLY, property, reply);
+    dbus_message_unref(reply);
+    if (!written) {
+        perror("ERROR: cannot write the capture");
+        return SPOTIFY_DBUS_ERROR;
+    }
+    return SPOTIFY_OK;
+}
+
+/**
+ * `record FILE [-n N]` command: writes Spotify's Metadata & PlaybackStatus replies, then every
+ * PropertiesChanged signal it sends (each followed by a fresh Metadata reply, as `follow` reads
+ * it) into a capture file for --replay. Runs until N signals were recorded, or until interrupted:
+ * records are flushed one by one, so the file is always usable.
+ */
+SpotifyError command_record(int argc, char *argv[], Backend *backend, DBusError *error)
+{
+    PlayerState state;
+    const char *path = NULL;
+    uint32_t limit = 0, signals = 0;
+    SpotifyError err;
+    FILE *file;
+
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            limit = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (path == NULL) {
+            path = argv[i];
+        }
+    }
+    if (path == NULL || backend->ops == &replay_backend) {
+        fprintf(stderr, "ERROR: usage: record FILE [-n N] (from the bus, not --replay)\n");
+        return SPOTIFY_BAD_ARGUMENT;
+    }
+
+    if (watch_player(&state, backend, error) != SPOTIFY_OK) {
+        return classify_error(error);
+    }
+    file = capture_create(path);
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: cannot write %s: %s\n", path, strerror(errno));
+        return SPOTIFY_DBUS_ERROR;
+    }
+
+    err = record_property(file, backend, "Metadata", error);
+    if (err == SPOTIFY_OK) {
+        err = record_property(file, backend, "PlaybackStatus", error);
+    }
+    while (err == SPOTIFY_OK && (limit == 0 || signals < limit)) {
+        DBusMessage *msg;
+        BackendEvent event = backend->ops->dispatch(backend, -1, &msg);
+
+        if (event == BACKEND_CLOSED) {
+            dbus_set_error_const(error, DBUS_ERROR_DISCONNECTED, "Disconnected from the session bus");
+            err = check_error(error);
+            break;
+        }
+        if (event == BACKEND_IDLE) {
+            continue;
+        }
+        if (dbus_message_is_signal(msg, "org.freedesktop.DBus", "NameOwnerChanged")) {
+            handle_name_owner_changed(&state, msg);
+        } else if (dbus_message_is_signal(msg, "org.freedesktop.DBus.Properties", "PropertiesChanged")
+                && (player_owner[0] == '\0' || strcmp(dbus_message_get_sender(msg), player_owner) == 0)) {
+            if (!capture_write_record(file, CAPTURE_SIGNAL, "PropertiesChanged", msg)) {
+                perror("ERROR: cannot write the capture");
+                err = SPOTIFY_DBUS_ERROR;
+            } else {
+                signals++;
+                err = record_property(file, backend, "Metadata", error);
+            }
+        }
+        dbus_message_unref(msg);
+    }
+
+    fclose(file);
+    output_str(&stdout_output, "recorded ");
+    output_uint(&stdout_output, signals);
+    output_str(&stdout_output, " signals into ");
+    output_str(&stdout_output, path);
+    output_char(&stdout_output, '\n');
+    output_flush(&stdout_output);
+    return err;
+}
+
+/**
+ * Looks a TrackInfo field up by name (e.g. "title") or MPRIS key (e.g. "xesam:title")
+ *
+ * @return The TrackField, or -1 if there is no such field
+ */
+static int find_track_field(const char *name)
+{
+    for (int i = 0; i < TRACK_FIELD_COUNT; ++i) {
+        if (strcmp(track_schema[i].name, name) == 0 || strcmp(track_schema[i].key, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Writes the value of a TrackInfo field as text
+ *
+ * @return SPOTIFY_NO_METADATA if the player did not provide the field
+ */
+static SpotifyError format_track_field(const TrackInfo *info, TrackField field, char *out, size_t outSize)
+{
+    const TrackFieldSpec *spec = &track_schema[field];
+    const char *value = (const char*)info + spec->offset;
+
+    if ((info->present & (1u << field)) == 0) {
+        return SPOTIFY_NO_METADATA;
+    }
+    switch (spec->kind) {
+        case FIELD_STRING:
+        case FIELD_FIRST_STRING:
+            snprintf(out, outSize, "%s", value);
+            break;
+        case FIELD_INT64:
+            snprintf(out, outSize, "%" PRId64, *(const int64_t*)value);
+            break;
+        case FIELD_INT32:
+            snprintf(out, outSize, "%" PRId32, *(const int32_t*)value);
+            break;
+    }
+    return SPOTIFY_OK;
+}
+
+/**
+ * Value watched by `wait`: a TrackInfo field, or the "[ARTIST] - [TITLE]" line when `field` is -1;
+ * empty when the player does not provide it
+ */
+static void watched_value(const TrackInfo *info, int field, char *out, size_t outSize)
+{
+    SpotifyError err = field < 0 ? format_track(info, out, outSize)
+                                 : format_track_field(info, (TrackField)field, out, outSize);
+    if (err != SPOTIFY_OK) {
+        out[0] = '\0';
+    }
+}
+
+/**
+ * `wait [--field KEY]` command: blocks on the bus connection until the track (or the given
+ * metadata field) changes, then prints its new value & exits.
+ *
+ * PropertiesChanged deltas are applied to the player state without a round trip to Spotify, and
+ * the field generations tell whether the watched fields changed; the process sleeps in the
+ * dispatch meanwhile.
+ */
+SpotifyError command_wait(int argc, char *argv[], Backend *backend, DBusError *error)
+{
+    PlayerState state;
+    char current[TRACK_CACHE_SIZE];
+    int field = -1;
+    uint32_t mask;
+    uint64_t since;
+
+    if (argc == 2 && strcmp(argv[0], "--field") == 0) {
+        field = find_track_field(argv[1]);
+    }
+    if (argc != 0 && field < 0) {
+        fprintf(stderr, "ERROR: usage: wait [--field KEY] (KEY: a TrackInfo field, e.g. title or xesam:title)\n");
+        return SPOTIFY_BAD_ARGUMENT;
+    }
+    mask = field < 0 ? PLAYER_FIELD_BIT(TRACK_FIELD_artist) | PLAYER_FIELD_BIT(TRACK_FIELD_title)
+                     : PLAYER_FIELD_BIT(field);
+
+    if (watch_player(&state, backend, error) != SPOTIFY_OK) {
+        return classify_error(error);
+    }
+    if (player_owner[0] != '\0') {
+        refresh_player_state(&state, error);
+        dbus_error_free(error);
+    }
+    since = state.generation;
+
+    while (!player_fields_changed(&state, mask, since)) {
+        int refresh = 0;
+        BackendEvent event = handle_player_signals(&state, -1, &refresh);
+
+        if (refresh && refresh_player_state(&state, error) != SPOTIFY_OK) {
+            dbus_error_free(error);
+        }
+        // The last changes received before the end may be the awaited one
+        if (event != BACKEND_IDLE && !player_fields_changed(&state, mask, since)) {
+            dbus_set_error_const(error, DBUS_ERROR_DISCONNECTED, event == BACKEND_END
+                                 ? "The capture ended before the change" : "Disconnected from the session bus");
+            return check_error(error);
+        }
     }
 
-    reply = dbus_connection_send_with_reply_and_block(conn, msg, -1, error);
-    check_error(error);
+    watched_value(&state.track, field, current, sizeof(current));
+    output_str(&stdout_output, current);
+    output_char(&stdout_output, '\n');
+    output_flush(&stdout_output);
+    return SPOTIFY_OK;
+}
 
-    dbus_message_unref(msg);
-    dbus_message_unref(reply);
+/**
+ * Writes the message of a failed service request, as check_error would print it, and frees
+ * `error`
+ */
+static SpotifyError output_service_error(Output *out, SpotifyError err, DBusError *error)
+{
+    if (err == SPOTIFY_NOT_RUNNING) {
+        output_str(out, "ERROR: is Spotify running?\n");
+    } else if (err == SPOTIFY_NO_METADATA) {
+        output_str(out, "Could not read artist/track metadata.\n");
+    } else {
+        output_str(out, "ERROR: ");
+        output_str(out, dbus_error_is_set(error) ? error->message : "request failed");
+        output_char(out, '\n');
+    }
+    dbus_error_free(error);
+    return err;
+}
+
+/**
+ * Answers one request of the service protocol (see service.h) into `out`
+ *
+ * `track` & `field` are served from the state kept up to date by PropertiesChanged signals,
+ * without any bus round trip; controls are forwarded to Spotify. `track` is rendered like the
+ * `track` command (--json, --pango, --max-width), fields as plain text.
+ */
+static SpotifyError handle_service_request(PlayerState *state, char *request, Output *out, DBusError *error)
+{
+    char text[TRACK_CACHE_SIZE];
+    SpotifyError err;
+
+    request[strcspn(request, "\r\n")] = '\0';
+
+    if (strcmp(request, "track") == 0 || strncmp(request, "field ", 6) == 0) {
+        if (!state->running) {
+            return output_service_error(out, SPOTIFY_NOT_RUNNING, error);
+        }
+        if (!state->hasTrack) {
+            return output_service_error(out, SPOTIFY_NO_METADATA, error);
+        }
+        if (request[0] == 't') {
+            err = format_track(&state->track, text, sizeof(text));
+            if (err != SPOTIFY_OK) {
+                return output_service_error(out, err, error);
+            }
+            output_track_line(out, &state->track, text, state->status);
+            return SPOTIFY_OK;
+        }
+        int field = find_track_field(request + 6);
+        if (field < 0) {
+            output_str(out, "ERROR: unknown field ");
+            output_str(out, request + 6);
+            output_char(out, '\n');
+            return SPOTIFY_BAD_ARGUMENT;
+        }
+        err = format_track_field(&state->track, (TrackField)field, text, sizeof(text));
+        if (err != SPOTIFY_OK) {
+            return output_service_error(out, err, error);
+        }
+        output_str(out, text);
+        return SPOTIFY_OK;
+    }
+
+    if (strcmp(request, "play") == 0) {
+        err = call_player_method(state->backend, "PlayPause", error);
+    } else if (strcmp(request, "next") == 0 || strcmp(request, "prev") == 0) {
+        err = send_skips(state->backend, request[0] == 'n' ? 1 : -1, error);
+    } else {
+        output_str(out, "ERROR: unsupported request ");
+        output_bytes(out, request, strnlen(request, 64));
+        output_char(out, '\n');
+        return SPOTIFY_BAD_ARGUMENT;
+    }
+    return err == SPOTIFY_OK ? err : output_service_error(out, err, error);
+}
+
+/**
+ * Reads the request line of a client, for at most SERVICE_REQUEST_TIMEOUT_MS in total
+ *
+ * @return Length of the request read (0 if the client sent nothing in time)
+ */
+static size_t read_service_request(int fd, char *request, size_t size)
+{
+    uint64_t deadline = monotonic_ns() + (uint64_t)SERVICE_REQUEST_TIMEOUT_MS * 1000000;
+    size_t len = 0;
+
+    while (len < size - 1 && memchr(request, '\n', len) == NULL) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        uint64_t now = monotonic_ns();
+        ssize_t n;
+
+        if (now >= deadline || poll(&pfd, 1, (int)((deadline - now + 999999) / 1000000)) <= 0) {
+            break;
+        }
+        n = read(fd, request + len, size - 1 - len);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    request[len] = '\0';
+    return len;
+}
+
+static Output service_output;
+
+/**
+ * Accepts one client connection, reads its request line & sends back the answer
+ *
+ * Clients are served one at a time; a client that does not send its request within
+ * SERVICE_REQUEST_TIMEOUT_MS is dropped, whatever the call deadline (-t 0 included), so that
+ * it cannot hold up the service.
+ */
+static void serve_client(PlayerState *state, int listenFd, DBusError *error)
+{
+    char request[SERVICE_REQUEST_SIZE];
+    Output *out = &service_output;
+    int fd;
+
+    fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    if (read_service_request(fd, request, sizeof(request)) > 0) {
+        // Status byte first, filled in once the request is answered
+        out->fd = fd;
+        out->len = 0;
+        output_char(out, 0);
+        SpotifyError err = handle_service_request(state, request, out, error);
+        out->buf[0] = (char)err;
+        output_flush(out);
+    }
+    close(fd);
+}
+
+/**
+ * Creates the listening socket of the service, replacing a stale one left by a dead service
+ *
+ * @return The socket fd, or -1 (reported on stderr) on failure
+ */
+static int open_service_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("ERROR: socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "ERROR: a service is already listening on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    unlink(path);
+
+    mode_t oldMask = umask(0077);
+    int bound = bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, 16) == 0;
+    umask(oldMask);
+    if (!bound) {
+        fprintf(stderr, "ERROR: cannot listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * `serve` command: resident service answering spotify-dbus-client requests over a Unix socket
+ * (see service.h), from a track state kept current like `follow` does.
+ *
+ * Requests are handled one at a time, so bursts of next/prev arrive serialized and are not
+ * coalesced.
+ */
+SpotifyError command_serve(Backend *backend, DBusError *error)
+{
+    PlayerState state;
+    char path[512];
+    int listenFd;
+
+    if (watch_player(&state, backend, error) != SPOTIFY_OK) {
+        return classify_error(error);
+    }
+
+    if (!runtime_file_path(SERVICE_SOCKET_NAME, path, sizeof(path))) {
+        fprintf(stderr, "ERROR: no private runtime directory: set XDG_RUNTIME_DIR, or check " RUNTIME_FALLBACK_DIR "\n",
+                (unsigned)getuid());
+        return SPOTIFY_DBUS_ERROR;
+    }
+    listenFd = open_service_socket(path);
+    if (listenFd < 0) {
+        return SPOTIFY_DBUS_ERROR;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    coalesce_window_ms = 0;
+
+    int refresh = player_owner[0] != '\0';
+    while (1) {
+        struct pollfd fds[2];
+
+        if (refresh) {
+            refresh_player_state(&state, error);
+        }
+        refresh = 0;
+
+        // Signals read while blocked in refresh_player_state wait in the backend's queue, where
+        // poll cannot see them: drain it before sleeping
+        BackendEvent event = handle_player_signals(&state, 0, &refresh);
+        if (event == BACKEND_CLOSED && !refresh) {
+            dbus_set_error_const(error, DBUS_ERROR_DISCONNECTED, "Disconnected from the session bus");
+            break;
+        }
+        if (refresh) {
+            continue;
+        }
+
+        fds[0].fd = backend->ops->poll_fd(backend);
+        fds[0].events = POLLIN;
+        fds[1].fd = listenFd;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            serve_client(&state, listenFd, error);
+        }
+    }
+
+    close(listenFd);
+    unlink(path);
+    return check_error(error);
+}
+
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_CONTEXT_SWITCHES,
+    COUNTER_COUNT
+} BenchCounter;
+
+static const char *bench_counter_names[COUNTER_COUNT] = {
+    "cycles",
+    "instructions",
+    "cache-misses",
+    "context-switches"
+};
+
+/**
+ * Opens a perf_event counter on the current thread, initially disabled
+ *
+ * Kernel-side counting is dropped when perf_event_paranoid forbids it.
+ *
+ * @return The counter fd, or -1 if perf counters are unavailable
+ */
+static int open_perf_counter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_hv = 1;
+
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0) {
+        attr.exclude_kernel = 1;
+        fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Value at percentile `pct` of a sorted sample array
+ */
+static uint64_t percentile(const uint64_t *sorted, uint32_t count, double pct)
+{
+    uint32_t rank = (uint32_t)(pct / 100.0 * (count - 1) + 0.5);
+    return sorted[rank < count ? rank : count - 1];
+}
+
+/**
+ * Writes a difference like printf's "%+.*f": positive values get a '+'
+ */
+static void output_signed_double(Output *out, double value, int decimals)
+{
+    if (!signbit(value)) {
+        output_char(out, '+');
+    }
+    output_double(out, value, decimals);
+}
+
+SpotifyError run_command(int argc, char *argv[], Backend *backend, DBusError *error);
+
+/**
+ * Per-character Pango escaping, the baseline of `bench escape`
+ */
+static size_t pango_escape_per_char(const char *src, size_t len, char *dst)
+{
+    char *d = dst;
+
+    for (size_t i = 0; i < len; ++i) {
+        switch (src[i]) {
+            case '&':  memcpy(d, "&amp;", 5); d += 5; break;
+            case '<':  memcpy(d, "&lt;", 4); d += 4; break;
+            case '>':  memcpy(d, "&gt;", 4); d += 4; break;
+            case '\'': memcpy(d, "&#39;", 5); d += 5; break;
+            case '"':  memcpy(d, "&quot;", 6); d += 6; break;
+            default:   *d++ = src[i]; break;
+        }
+    }
+    *d = '\0';
+    return (size_t)(d - dst);
+}
+
+/**
+ * Per-character JSON escaping, the baseline of `bench escape`
+ */
+static size_t json_escape_per_char(const char *src, size_t len, char *dst)
+{
+    char *d = dst;
+
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)src[i];
+
+        switch (c) {
+            case '"':  memcpy(d, "\\\"", 2); d += 2; break;
+            case '\\': memcpy(d, "\\\\", 2); d += 2; break;
+            case '\b': memcpy(d, "\\b", 2); d += 2; break;
+            case '\f': memcpy(d, "\\f", 2); d += 2; break;
+            case '\n': memcpy(d, "\\n", 2); d += 2; break;
+            case '\r': memcpy(d, "\\r", 2); d += 2; break;
+            case '\t': memcpy(d, "\\t", 2); d += 2; break;
+            default:
+                if (c < 0x20) {
+                    d += sprintf(d, "\\u%04x", c);
+                } else {
+                    *d++ = (char)c;
+                }
+                break;
+        }
+    }
+    *d = '\0';
+    return (size_t)(d - dst);
+}
+
+/**
+ * `bench escape`: throughput of the escaping kernels over a title-sized & a long multi-byte
+ * string, with a sprinkling of characters to escape
+ */
+static SpotifyError bench_escape(uint32_t runs)
+{
+    static const char piece[] = "日本語のタイトル & <Live> \"Remaster\" 🎵 — Ünïcödé 'edit' ";
+    static const struct {
+        const char *name;
+        size_t (*escape)(const char*, size_t, char*);
+    } kernels[] = {
+        { "pango", pango_escape },
+        { "pango-per-char", pango_escape_per_char },
+        { "json", json_escape },
+        { "json-per-char", json_escape_per_char },
+    };
+    char text[4096];
+    size_t lengths[2];
+    char *escaped;
+    volatile size_t sink = 0;
+
+    lengths[0] = sizeof(piece) - 1;
+    for (lengths[1] = 0; lengths[1] + sizeof(piece) <= sizeof(text); lengths[1] += sizeof(piece) - 1) {
+        memcpy(text + lengths[1], piece, sizeof(piece) - 1);
+    }
+    escaped = mem_alloc(ESCAPE_MAX(sizeof(text)) + 1);
+    if (escaped == NULL) {
+        return SPOTIFY_NO_MEMORY;
+    }
+
+    Output *out = &stdout_output;
+    output_str(out, "bench escape: ");
+    output_uint(out, runs);
+    output_str(out, " runs per kernel\n");
+    for (int l = 0; l < 2; ++l) {
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+            uint64_t start = monotonic_ns(), elapsed;
+            for (uint32_t i = 0; i < runs; ++i) {
+                sink += kernels[k].escape(text, lengths[l], escaped);
+            }
+            elapsed = monotonic_ns() - start;
+            output_str(out, "  ");
+            output_uint_padded(out, lengths[l], 4);
+            output_str(out, " bytes  ");
+            output_padded(out, kernels[k].name, strlen(kernels[k].name), -15);
+            output_char(out, ' ');
+            output_double_padded(out, (double)elapsed / runs, 1, 9);
+            output_str(out, " ns per string  ");
+            output_double_padded(out, (double)lengths[l] * runs * 1000.0 / (elapsed ? elapsed : 1), 1, 8);
+            output_str(out, " MB/s\n");
+        }
+    }
+    output_flush(out);
+
+    mem_free(escaped);
+    return SPOTIFY_OK;
+}
+
+/**
+ * `bench backend`: measures the cost of going through BackendOps, by fetching & decoding the
+ * recorded Metadata reply once through the vtable and once through a direct call to the replay
+ * backend on each run, so that both see the same cache state
+ */
+static SpotifyError bench_backend_indirection(uint32_t runs, Backend *backend, DBusError *error)
+{
+    static const char *labels[2] = { "vtable", "direct" };
+    uint64_t *samples[2];
+    uint64_t totalNs[2] = { 0, 0 };
+    volatile uint32_t sink = 0;
+
+    if (backend->ops != &replay_backend) {
+        fprintf(stderr, "ERROR: bench backend needs --replay FILE\n");
+        return SPOTIFY_BAD_ARGUMENT;
+    }
+    samples[0] = mem_alloc(runs * sizeof(uint64_t));
+    samples[1] = mem_alloc(runs * sizeof(uint64_t));
+    if (samples[0] == NULL || samples[1] == NULL) {
+        mem_free(samples[0]);
+        mem_free(samples[1]);
+        return SPOTIFY_NO_MEMORY;
+    }
+
+    for (uint32_t i = 0; i < runs; ++i) {
+        for (int v = 0; v < 2; ++v) {
+            DBusMessage *reply;
+            DBusMessageIter entries, variant;
+            const char *key;
+            TrackInfo info;
+            uint64_t start = monotonic_ns();
+
+            if (v == 0) {
+                reply = backend->ops->get_property(backend, SPOTIFY_BUS_NAME, MPRIS_PATH, MPRIS_PLAYER_INTERFACE,
+                                                   "Metadata", call_timeout_ms, error);
+            } else {
+                reply = replay_get_property(backend, SPOTIFY_BUS_NAME, MPRIS_PATH, MPRIS_PLAYER_INTERFACE,
+                                            "Metadata", call_timeout_ms, error);
+            }
+            if (reply == NULL || !metadata_reply_entries(reply, &entries, error)) {
+                if (reply != NULL) {
+                    dbus_message_unref(reply);
+                }
+                mem_free(samples[0]);
+                mem_free(samples[1]);
+                return check_error(error);
+            }
+            init_track_info(&info);
+            while (next_dict_entry(&entries, &key, &variant)) {
+                decode_track_entry(&info, key, &variant);
+            }
+            dbus_message_unref(reply);
+            sink += info.present;
+
+            samples[v][i] = monotonic_ns() - start;
+            totalNs[v] += samples[v][i];
+        }
+    }
+
+    Output *out = &stdout_output;
+    output_str(out, "bench backend: ");
+    output_uint(out, runs);
+    output_str(out, " runs over ");
+    output_str(out, backend->source);
+    output_char(out, '\n');
+    for (int v = 0; v < 2; ++v) {
+        qsort(samples[v], runs, sizeof(uint64_t), compare_u64);
+        output_str(out, "  ");
+        output_padded(out, labels[v], strlen(labels[v]), -6);
+        output_str(out, " latency (us): mean ");
+        output_double(out, totalNs[v] / 1000.0 / runs, 3);
+        output_str(out, "  p50 ");
+        output_double(out, percentile(samples[v], runs, 50) / 1000.0, 3);
+        output_str(out, "  p99 ");
+        output_double(out, percentile(samples[v], runs, 99) / 1000.0, 3);
+        output_char(out, '\n');
+    }
+    output_str(out, "  indirection: ");
+    output_signed_double(out, ((double)totalNs[0] - (double)totalNs[1]) / runs, 1);
+    output_str(out, " ns per call (mean), ");
+    output_signed_double(out, (double)percentile(samples[0], runs, 50) - (double)percentile(samples[1], runs, 50), 1);
+    output_str(out, " ns (p50)\n");
+    output_flush(out);
+
+    mem_free(samples[0]);
+    mem_free(samples[1]);
+    return SPOTIFY_OK;
+}
+
+/**
+ * Metadata payload of a capture record: a Metadata reply or a PropertiesChanged signal carrying it
+ *
+ * @return 1 with `entries` on the first dict entry, 0 if the record has none
+ */
+static int record_metadata_entries(DBusMessage *msg, CaptureKind kind, const char *name, DBusMessageIter *entries)
+{
+    if (kind == CAPTURE_PROPERTY_REPLY) {
+        return strcmp(name, "Metadata") == 0 && metadata_reply_entries(msg, entries, NULL);
+    }
+    return kind == CAPTURE_SIGNAL && changed_metadata_entries(msg, entries);
+}
+
+/**
+ * `bench decode`: decode throughput over the real-world payloads of a capture (--replay): the
+ * recorded messages carrying Metadata, demarshalled once, are decoded N times each into a
+ * TrackInfo (the `track`/`follow` path) & into a full MetadataArray (process_variant)
+ */
+static SpotifyError bench_decode(uint32_t runs, Backend *backend)
+{
+    static const char *labels[2] = { "track", "metadata" };
+    MetadataArray *metadata;
+    uint32_t payloads = 0;
+    size_t bytes = 0, size;
+    volatile uint32_t sink = 0;
+    DBusMessageIter entries, variant;
+    DBusMessage *msg;
+    CaptureKind kind;
+    const char *name, *key;
+
+    if (backend->ops != &replay_backend) {
+        fprintf(stderr, "ERROR: bench decode needs --replay FILE\n");
+        return SPOTIFY_BAD_ARGUMENT;
+    }
+    for (size_t r = 0; (msg = replay_record(backend, r, &kind, &name, &size)) != NULL; ++r) {
+        if (record_metadata_entries(msg, kind, name, &entries)) {
+            payloads++;
+            bytes += size;
+        }
+    }
+    if (payloads == 0) {
+        fprintf(stderr, "ERROR: no Metadata payload in %s\n", backend->source);
+        return SPOTIFY_NO_METADATA;
+    }
+    metadata = mem_alloc(sizeof(MetadataArray));
+    if (metadata == NULL) {
+        return SPOTIFY_NO_MEMORY;
+    }
+
+    Output *out = &stdout_output;
+    output_str(out, "bench decode: ");
+    output_uint(out, runs);
+    output_str(out, " runs over ");
+    output_uint(out, payloads);
+    output_str(out, " payloads (");
+    output_uint(out, bytes);
+    output_str(out, " bytes) of ");
+    output_str(out, backend->source);
+    output_char(out, '\n');
+    for (int d = 0; d < 2; ++d) {
+        uint64_t start = monotonic_ns(), elapsed;
+
+        for (uint32_t i = 0; i < runs; ++i) {
+            for (size_t r = 0; (msg = replay_record(backend, r, &kind, &name, &size)) != NULL; ++r) {
+                TrackInfo info;
+
+                if (!record_metadata_entries(msg, kind, name, &entries)) {
+                    continue;
+                }
+                if (d == 0) {
+                    init_track_info(&info);
+                    while (next_dict_entry(&entries, &key, &variant)) {
+                        decode_track_entry(&info, key, &variant);
+                    }
+                    sink += info.present;
+                } else {
+                    init_metadata_array(metadata);
+                    while (next_dict_entry(&entries, &key, &variant)) {
+                        process_variant(&variant, key, metadata);
+                    }
+                    sink += metadata->curIndex;
+                }
+            }
+        }
+        elapsed = monotonic_ns() - start;
+        output_str(out, "  ");
+        output_padded(out, labels[d], strlen(labels[d]), -8);
+        output_char(out, ' ');
+        output_double_padded(out, (double)elapsed / 1000.0 / ((double)runs * payloads), 3, 8);
+        output_str(out, " us per payload  ");
+        output_double_padded(out, (double)bytes * runs * 1000.0 / (elapsed ? elapsed : 1), 1, 8);
+        output_str(out, " MB/s\n");
+    }
+    output_flush(out);
+
+    mem_free(metadata);
+    return SPOTIFY_OK;
+}
 
+/**
+ * Tells whether `bench ARGS` runs without a connected backend: `escape` never uses one, and
+ * `decode` & `backend` refuse to run on the bus (with --replay, connect loads their capture)
+ */
+static int bench_without_connection(int argc, char *argv[], const Backend *backend)
+{
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            ++i;
+            continue;
+        }
+        return strcmp(argv[i], "escape") == 0
+            || (backend->ops != &replay_backend && (strcmp(argv[i], "decode") == 0 || strcmp(argv[i], "backend") == 0));
+    }
     return 0;
 }
 
-int command_metadata(DBusConnection *conn, DBusError *error)
+/**
+ * `bench` command: runs another command N times in-process over the same connection, then
+ * reports latency percentiles and per-run hardware/software counters (when perf_event_open is
+ * permitted; they are reported as unavailable otherwise).
+ *
+ * The benchmarked command's stdout is discarded, and burst coalescing is disabled so that each
+ * run performs its D-Bus calls right away.
+ */
+SpotifyError command_bench(int argc, char *argv[], Backend *backend, DBusError *error)
 {
-    int retval = 0;
-    MetadataArray metadata;
+    uint32_t runs = DEFAULT_BENCH_RUNS;
+    char *cmdArgv[8];
+    int cmdArgc = 0;
+    int counters[COUNTER_COUNT];
+    uint64_t *samples;
+    uint64_t totalNs = 0;
+    uint32_t failures = 0;
+    int savedStdout, devNull;
 
-    init_metadata_array(&metadata);
-    get_dbus_metadata(conn, &metadata, error);
-    print_metadata_array(metadata);
-    free_metadata_array(&metadata);
-    return retval;
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            runs = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (cmdArgc < (int)(sizeof(cmdArgv) / sizeof(cmdArgv[0]))) {
+            cmdArgv[cmdArgc++] = argv[i];
+        }
+    }
+    // Resident commands never return
+    if (cmdArgc == 0 || runs == 0 || strcmp(cmdArgv[0], "bench") == 0 || strcmp(cmdArgv[0], "follow") == 0
+            || strcmp(cmdArgv[0], "serve") == 0 || strcmp(cmdArgv[0], "record") == 0
+            || strcmp(cmdArgv[0], "wait") == 0 || (strcmp(cmdArgv[0], "track") == 0 && cmdArgc > 1)) {
+        fprintf(stderr, "ERROR: usage: bench <command> [args] [-n N]\n");
+        return SPOTIFY_BAD_ARGUMENT;
+    }
+    if (strcmp(cmdArgv[0], "backend") == 0) {
+        return bench_backend_indirection(runs, backend, error);
+    }
+    if (strcmp(cmdArgv[0], "escape") == 0) {
+        return bench_escape(runs);
+    }
+    if (strcmp(cmdArgv[0], "decode") == 0) {
+        return bench_decode(runs, backend);
+    }
+    samples = mem_alloc(runs * sizeof(uint64_t));
+    if (samples == NULL) {
+        return SPOTIFY_NO_MEMORY;
+    }
+
+    counters[COUNTER_CYCLES] = open_perf_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters[COUNTER_INSTRUCTIONS] = open_perf_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters[COUNTER_CACHE_MISSES] = open_perf_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    counters[COUNTER_CONTEXT_SWITCHES] = open_perf_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+
+    coalesce_window_ms = 0;
+    output_flush(&stdout_output);
+    savedStdout = dup(STDOUT_FILENO);
+    devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (savedStdout >= 0 && devNull >= 0) {
+        dup2(devNull, STDOUT_FILENO);
+    }
+
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        if (counters[c] >= 0) {
+            ioctl(counters[c], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters[c], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    for (uint32_t i = 0; i < runs; ++i) {
+        uint64_t start = monotonic_ns();
+        if (run_command(cmdArgc, cmdArgv, backend, error) != SPOTIFY_OK) {
+            failures++;
+        }
+        samples[i] = monotonic_ns() - start;
+        totalNs += samples[i];
+    }
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        if (counters[c] >= 0) {
+            ioctl(counters[c], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    output_flush(&stdout_output);
+    if (savedStdout >= 0 && devNull >= 0) {
+        dup2(savedStdout, STDOUT_FILENO);
+    }
+    if (savedStdout >= 0) {
+        close(savedStdout);
+    }
+    if (devNull >= 0) {
+        close(devNull);
+    }
+
+    qsort(samples, runs, sizeof(uint64_t), compare_u64);
+    Output *out = &stdout_output;
+    output_str(out, "bench ");
+    output_str(out, cmdArgv[0]);
+    output_str(out, ": ");
+    output_uint(out, runs);
+    output_str(out, " runs, ");
+    output_uint(out, failures);
+    output_str(out, " failed\n  latency (us): mean ");
+    output_double(out, totalNs / 1000.0 / runs, 1);
+    output_str(out, "  p50 ");
+    output_double(out, percentile(samples, runs, 50) / 1000.0, 1);
+    output_str(out, "  p90 ");
+    output_double(out, percentile(samples, runs, 90) / 1000.0, 1);
+    output_str(out, "  p99 ");
+    output_double(out, percentile(samples, runs, 99) / 1000.0, 1);
+    output_str(out, "  max ");
+    output_double(out, samples[runs - 1] / 1000.0, 1);
+    output_char(out, '\n');
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        uint64_t value;
+        output_str(out, "  ");
+        output_padded(out, bench_counter_names[c], strlen(bench_counter_names[c]), -17);
+        if (counters[c] >= 0 && read(counters[c], &value, sizeof(value)) == sizeof(value)) {
+            output_char(out, ' ');
+            output_double(out, (double)value / runs, 1);
+            output_str(out, " per run\n");
+        } else {
+            output_str(out, " unavailable\n");
+        }
+        if (counters[c] >= 0) {
+            close(counters[c]);
+        }
+    }
+    output_flush(out);
+
+    mem_free(samples);
+    return SPOTIFY_OK;
+}
+
+/**
+ * Runs the command named by argv[0] (with its arguments in argv[1..argc-1])
+ */
+SpotifyError run_command(int argc, char *argv[], Backend *backend, DBusError *error)
+{
+    if (strcmp(argv[0], "track") == 0) {
+        return argc > 1 ? command_marquee(argc - 1, argv + 1, backend, error) : command_track(backend, error);
+    } else if (strcmp(argv[0], "metadata") == 0) {
+        return command_metadata(backend, error);
+    } else if (strcmp(argv[0], "p") == 0 || strcmp(argv[0], "play") == 0) {
+        return command_play_pause(backend, error);
+    } else if (strcmp(argv[0], "next") == 0) {
+        return command_next_or_prev(NEXT, backend, error);
+    } else if (strcmp(argv[0], "prev") == 0) {
+        return command_next_or_prev(PREV, backend, error);
+    } else if (strcmp(argv[0], "seek") == 0) {
+        return command_seek(argc > 1 ? argv[1] : NULL, backend, error);
+    } else if (strcmp(argv[0], "position") == 0) {
+        return command_position(argc > 1 ? argv[1] : NULL, backend, error);
+    } else if (strcmp(argv[0], "volume") == 0) {
+        return command_volume(argc > 1 ? argv[1] : NULL, backend, error);
+    } else if (strcmp(argv[0], "follow") == 0) {
+        return command_follow(backend, error);
+    } else if (strcmp(argv[0], "serve") == 0) {
+        return command_serve(backend, error);
+    } else if (strcmp(argv[0], "wait") == 0) {
+        return command_wait(argc - 1, argv + 1, backend, error);
+    } else if (strcmp(argv[0], "record") == 0) {
+        return command_record(argc - 1, argv + 1, backend, error);
+    } else if (strcmp(argv[0], "bench") == 0) {
+        return command_bench(argc - 1, argv + 1, backend, error);
+    }
+    output_str(&stdout_output, "Command not supported.\n");
+    print_usage(&stdout_output);
+    output_flush(&stdout_output);
+    return SPOTIFY_OK;
 }
 
 int main(int argc, char *argv[])
 {
-    int retval = 0;
+    SpotifyError retval = SPOTIFY_OK;
     DBusError error;
-    DBusConnection *conn;
+    Backend backend = { &libdbus_backend, NULL, NULL };
+
+    // Global options come before the command
+    while (argc > 1 && argv[1][0] == '-') {
+        if ((strcmp(argv[1], "-t") == 0 || strcmp(argv[1], "--timeout") == 0) && argc > 2) {
+            call_timeout_ms = atoi(argv[2]);
+            if (call_timeout_ms <= 0) {
+                call_timeout_ms = DBUS_TIMEOUT_INFINITE;
+            }
+            argc--;
+            argv++;
+        } else if (strcmp(argv[1], "--window") == 0 && argc > 2) {
+            coalesce_window_ms = atoi(argv[2]);
+            argc--;
+            argv++;
+        } else if (strcmp(argv[1], "--settle") == 0 && argc > 2) {
+            settle_window_ms = atoi(argv[2]);
+            if (settle_window_ms < 0) {
+                settle_window_ms = 0;
+            }
+            argc--;
+            argv++;
+        } else if (strcmp(argv[1], "--confirm") == 0) {
+            confirm_calls = 1;
+        } else if (strcmp(argv[1], "--libdbus") == 0) {
+            use_wire_transport = 0;
+        } else if (strcmp(argv[1], "--json") == 0) {
+            // The PlaybackStatus needs a second call, which the wire client does not make
+            output_format = FORMAT_JSON;
+            use_wire_transport = 0;
+        } else if (strcmp(argv[1], "--pango") == 0) {
+            output_format = FORMAT_PANGO;
+        } else if (strcmp(argv[1], "--max-width") == 0 && argc > 2) {
+            int width = atoi(argv[2]);
+            max_width = width > 0 ? (size_t)width : 0;
+            argc--;
+            argv++;
+        } else if (strcmp(argv[1], "--replay") == 0 && argc > 2) {
+            backend.ops = &replay_backend;
+            backend.source = argv[2];
+            use_wire_transport = 0;
+            argc--;
+            argv++;
+        } else {
+            break;
+        }
+        argc--;
+        argv++;
+    }
 
     dbus_error_init(&error);
-    conn = dbus_bus_get(DBUS_BUS_SESSION, &error);
-    check_error(&error);
 
-    if (argc > 1) {
-        if (strcmp(argv[1], "track") == 0) {
-            retval = command_track(conn, &error);
-        } else if (strcmp(argv[1], "metadata") == 0) {
-            retval = command_metadata(conn, &error);
-        } else if (strcmp(argv[1], "p") == 0 || strcmp(argv[1], "play") == 0) {
-            retval = command_play_pause(conn, &error);
-        } else if (strcmp(argv[1], "next") == 0) {
-            retval = command_next_or_prev(NEXT, conn, &error);
-        } else if (strcmp(argv[1], "prev") == 0) {
-            retval = command_next_or_prev(PREV, conn, &error);
-        } else {
-            printf("Command not supported.\n");
-            print_usage();
+    // The read-only hot path skips the libdbus connection setup altogether when it can
+    if (argc == 2 && strcmp(argv[1], "track") == 0 && use_wire_transport) {
+        alloc_stats_begin();
+        if (command_track_wire(&error, &retval)) {
+            alloc_stats_report("track (wire)");
+            return retval;
         }
+    }
+
+    // Benchmarks of local code run even without a session bus
+    if (argc > 1 && strcmp(argv[1], "bench") == 0 && bench_without_connection(argc - 2, argv + 2, &backend)) {
+        alloc_stats_begin();
+        retval = command_bench(argc - 2, argv + 2, &backend, &error);
+        alloc_stats_report(argv[1]);
+        return retval;
+    }
+
+    alloc_stats_begin();
+    int connected = backend.ops->connect(&backend, &error);
+    alloc_stats_report("connect");
+    if (!connected) {
+        return check_error(&error);
+    }
+
+    if (argc > 1) {
+        alloc_stats_begin();
+        retval = run_command(argc - 1, argv + 1, &backend, &error);
+        alloc_stats_report(argv[1]);
     } else {
-        print_usage();
+        print_usage(&stdout_output);
+        output_flush(&stdout_output);
     }
 
-    // Free the DBus connection
-    dbus_connection_unref(conn);
+    // Close the bus connection (or release the capture)
+    backend.ops->disconnect(&backend);
 
     return retval;
 }
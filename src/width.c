@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "escape.h"
+#include "width.h"
+#include "width_tables.h"
+
+// Layout of the char_property_blocks entries
+#define CHAR_BREAK_MASK 0x0f
+#define CHAR_PICTOGRAPHIC 0x10
+#define CHAR_WIDTH_SHIFT 5
+
+#define VARIATION_SELECTOR_16 0xfe0f
+
+static unsigned char_properties(uint32_t cp)
+{
+    return char_property_blocks[char_block_index[cp >> CHAR_BLOCK_SHIFT]][cp & ((1u << CHAR_BLOCK_SHIFT) - 1)];
+}
+
+/**
+ * Code point of a valid UTF-8 sequence of `n` bytes
+ */
+static uint32_t decode_utf8(const unsigned char *s, size_t n)
+{
+    switch (n) {
+        case 1:  return s[0];
+        case 2:  return (uint32_t)(s[0] & 0x1f) << 6 | (s[1] & 0x3f);
+        case 3:  return (uint32_t)(s[0] & 0x0f) << 12 | (uint32_t)(s[1] & 0x3f) << 6 | (s[2] & 0x3f);
+        default: return (uint32_t)(s[0] & 0x07) << 18 | (uint32_t)(s[1] & 0x3f) << 12
+                        | (uint32_t)(s[2] & 0x3f) << 6 | (s[3] & 0x3f);
+    }
+}
+
+/**
+ * Whether a grapheme cluster boundary separates two code points (rules GB3 to GB999)
+ *
+ * @param oddRegional   An odd number of regional indicators directly precede `next`
+ * @param emojiJoiner   `prev` is a ZWJ following an Extended_Pictographic (& Extends)
+ */
+static int is_cluster_boundary(GraphemeBreak prev, GraphemeBreak next, int nextPictographic,
+                               int oddRegional, int emojiJoiner)
+{
+    if (prev == GCB_CR && next == GCB_LF) {
+        return 0;
+    }
+    if (prev == GCB_CR || prev == GCB_LF || prev == GCB_CONTROL
+        || next == GCB_CR || next == GCB_LF || next == GCB_CONTROL) {
+        return 1;
+    }
+    if (prev == GCB_L && (next == GCB_L || next == GCB_V || next == GCB_LV || next == GCB_LVT)) {
+        return 0;
+    }
+    if ((prev == GCB_LV || prev == GCB_V) && (next == GCB_V || next == GCB_T)) {
+        return 0;
+    }
+    if ((prev == GCB_LVT || prev == GCB_T) && next == GCB_T) {
+        return 0;
+    }
+    if (next == GCB_EXTEND || next == GCB_ZWJ || next == GCB_SPACING_MARK || prev == GCB_PREPEND) {
+        return 0;
+    }
+    if (emojiJoiner && nextPictographic) {
+        return 0;
+    }
+    return !(prev == GCB_REGIONAL_INDICATOR && next == GCB_REGIONAL_INDICATOR && oddRegional);
+}
+
+size_t grapheme_cluster_end(const char *str, size_t len, size_t start, size_t *width)
+{
+    const unsigned char *s = (const unsigned char*)str, *end = s + len, *p = s + start;
+    GraphemeBreak prev = GCB_CONTROL;
+    size_t clusterWidth = 0;
+    int oddRegional = 0, clusterPictographic = 0;
+    // 1 after an Extended_Pictographic (& Extends), 2 after a ZWJ following one
+    int emojiState = 0;
+
+    while (p < end) {
+        size_t n = utf8_sequence_length(p, end);
+        uint32_t cp = n != 0 ? decode_utf8(p, n) : 0xfffd;
+        unsigned props = n != 0 ? char_properties(cp) : GCB_OTHER | 1u << CHAR_WIDTH_SHIFT;
+        GraphemeBreak gcb = (GraphemeBreak)(props & CHAR_BREAK_MASK);
+        int pictographic = (props & CHAR_PICTOGRAPHIC) != 0;
+        size_t charWidth = props >> CHAR_WIDTH_SHIFT;
+
+        if (p == s + start) {
+            clusterWidth = charWidth;
+            clusterPictographic = pictographic;
+        } else if (is_cluster_boundary(prev, gcb, pictographic, oddRegional, emojiState == 2)) {
+            break;
+        } else if (gcb == GCB_REGIONAL_INDICATOR || (cp == VARIATION_SELECTOR_16 && clusterPictographic)) {
+            // Flags & emoji presentation of text-style pictographs
+            clusterWidth = 2;
+        } else if (charWidth > clusterWidth) {
+            clusterWidth = charWidth;
+        }
+
+        oddRegional = gcb == GCB_REGIONAL_INDICATOR && !oddRegional;
+        if (pictographic) {
+            emojiState = 1;
+        } else if (emojiState == 1 && gcb == GCB_ZWJ) {
+            emojiState = 2;
+        } else if (emojiState != 1 || gcb != GCB_EXTEND) {
+            emojiState = 0;
+        }
+        prev = gcb;
+        p += n != 0 ? n : 1;
+    }
+
+    *width = clusterWidth;
+    return (size_t)(p - s);
+}
+
+void measure_text(const char *s, size_t len, size_t limit, TextMeasure *measure)
+{
+    size_t pos = 0, width = 0, clusterWidth;
+    int fits = 1;
+
+    measure->fitLength = 0;
+    measure->fitWidth = 0;
+    while (pos < len) {
+        pos = grapheme_cluster_end(s, len, pos, &clusterWidth);
+        width += clusterWidth;
+        if (fits && width <= limit) {
+            measure->fitLength = pos;
+            measure->fitWidth = width;
+        } else {
+            fits = 0;
+        }
+    }
+    measure->width = width;
+}
+
+size_t truncate_text(const char *s, size_t len, size_t maxWidth, char *dst, size_t *width)
+{
+    TextMeasure measure;
+    size_t cut;
+
+    measure_text(s, len, maxWidth > 0 ? maxWidth - 1 : 0, &measure);
+    if (measure.width <= maxWidth) {
+        memcpy(dst, s, len);
+        dst[len] = '\0';
+        *width = measure.width;
+        return len;
+    }
+    if (maxWidth == 0) {
+        dst[0] = '\0';
+        *width = 0;
+        return 0;
+    }
+
+    // No dangling spaces before the ellipsis ("ARTIST -…")
+    cut = measure.fitLength;
+    *width = measure.fitWidth + 1;
+    while (cut > 0 && s[cut - 1] == ' ') {
+        cut--;
+        (*width)--;
+    }
+    memcpy(dst, s, cut);
+    memcpy(dst + cut, ELLIPSIS, sizeof(ELLIPSIS));
+    return cut + sizeof(ELLIPSIS) - 1;
+}
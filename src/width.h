@@ -0,0 +1,68 @@
+#ifndef SPOTIFY_DBUS_WIDTH_H
+#define SPOTIFY_DBUS_WIDTH_H
+
+#include <stddef.h>
+
+/**
+ * Display width of UTF-8 text, in terminal/bar columns.
+ *
+ * Text is segmented into grapheme clusters (UAX #29: combining marks, ZWJ emoji sequences, flags,
+ * Hangul syllables...), each as wide as its widest code point: 2 for East Asian Wide/Fullwidth
+ * characters & emoji, 1 otherwise. Per-code-point properties come from the two-stage tables of
+ * width_tables.h, generated by tools/gen-width-tables.py.
+ */
+
+// "…", appended to truncated text (1 column)
+#define ELLIPSIS "\xe2\x80\xa6"
+
+/**
+ * Grapheme_Cluster_Break property values (order shared with tools/gen-width-tables.py)
+ */
+typedef enum {
+    GCB_OTHER,
+    GCB_CR,
+    GCB_LF,
+    GCB_CONTROL,
+    GCB_EXTEND,
+    GCB_ZWJ,
+    GCB_REGIONAL_INDICATOR,
+    GCB_PREPEND,
+    GCB_SPACING_MARK,
+    GCB_L,
+    GCB_V,
+    GCB_T,
+    GCB_LV,
+    GCB_LVT
+} GraphemeBreak;
+
+typedef struct {
+    size_t width;       // Width of the whole text
+    size_t fitLength;   // Bytes of the longest prefix ending on a cluster boundary that fits the limit
+    size_t fitWidth;    // Width of that prefix
+} TextMeasure;
+
+/**
+ * Finds the end of the grapheme cluster starting at byte `start` (a cluster boundary)
+ *
+ * @param width Set to the display width of the cluster
+ * @return Offset of the next cluster
+ */
+size_t grapheme_cluster_end(const char *s, size_t len, size_t start, size_t *width);
+
+/**
+ * Measures text in a single pass: its total width & where to cut it to fit `limit` columns
+ *
+ * Invalid UTF-8 bytes count as one column each.
+ */
+void measure_text(const char *s, size_t len, size_t limit, TextMeasure *measure);
+
+/**
+ * Copies `len` bytes of text into `dst`, cut to `maxWidth` columns with ELLIPSIS if wider
+ *
+ * @param dst   At least len + sizeof(ELLIPSIS) bytes; the result is NUL-terminated
+ * @param width Set to the display width of the result
+ * @return Length of the result
+ */
+size_t truncate_text(const char *s, size_t len, size_t maxWidth, char *dst, size_t *width);
+
+#endif
@@ -0,0 +1,718 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "wire.h"
+
+#define MESSAGE_METHOD_CALL 1
+#define MESSAGE_METHOD_RETURN 2
+#define MESSAGE_ERROR 3
+
+#define FIELD_PATH 1
+#define FIELD_INTERFACE 2
+#define FIELD_MEMBER 3
+#define FIELD_ERROR_NAME 4
+#define FIELD_REPLY_SERIAL 5
+#define FIELD_DESTINATION 6
+#define FIELD_SIGNATURE 8
+
+#define HEADER_FIXED_SIZE 16
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NATIVE_ENDIAN 'l'
+#else
+#define NATIVE_ENDIAN 'B'
+#endif
+
+/**
+ * Output buffer used to marshal outgoing messages
+ */
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    int ok;
+} WireWriter;
+
+static size_t align_up(size_t pos, size_t alignment)
+{
+    return (pos + alignment - 1) & ~(alignment - 1);
+}
+
+static size_t type_alignment(char type)
+{
+    switch (type) {
+        case 'n': case 'q':
+            return 2;
+        case 'b': case 'i': case 'u': case 'h': case 's': case 'o': case 'a':
+            return 4;
+        case 'x': case 't': case 'd': case '(': case '{':
+            return 8;
+        default:
+            return 1;
+    }
+}
+
+/*
+ * Writer
+ */
+
+static void write_pad(WireWriter *w, size_t alignment)
+{
+    size_t aligned = align_up(w->len, alignment);
+
+    if (aligned > w->cap) {
+        w->ok = 0;
+        return;
+    }
+    memset(w->data + w->len, 0, aligned - w->len);
+    w->len = aligned;
+}
+
+static void write_bytes(WireWriter *w, const void *bytes, size_t size)
+{
+    if (!w->ok || w->len + size > w->cap) {
+        w->ok = 0;
+        return;
+    }
+    memcpy(w->data + w->len, bytes, size);
+    w->len += size;
+}
+
+static void write_u32(WireWriter *w, uint32_t value)
+{
+    write_pad(w, 4);
+    write_bytes(w, &value, sizeof(value));
+}
+
+static void write_string(WireWriter *w, const char *str)
+{
+    uint32_t len = (uint32_t)strlen(str);
+
+    write_u32(w, len);
+    write_bytes(w, str, len + 1);
+}
+
+static void write_signature(WireWriter *w, const char *sig)
+{
+    uint8_t len = (uint8_t)strlen(sig);
+
+    write_bytes(w, &len, 1);
+    write_bytes(w, sig, len + 1);
+}
+
+static void write_header_field(WireWriter *w, uint8_t code, const char *type, const char *value)
+{
+    write_pad(w, 8);
+    write_bytes(w, &code, 1);
+    write_signature(w, type);
+    if (type[0] == 'g') {
+        write_signature(w, value);
+    } else {
+        write_string(w, value);
+    }
+}
+
+/**
+ * Marshals a method call whose arguments are all strings (signature "s...s")
+ */
+static void write_method_call(WireWriter *w, uint32_t serial, const char *destination, const char *path,
+                              const char *interface, const char *member, const char **args, int argCount)
+{
+    size_t start, fieldsStart, bodyStart;
+    uint32_t fieldsLen, bodyLen;
+    char sig[16];
+    const unsigned char fixed[4] = { NATIVE_ENDIAN, MESSAGE_METHOD_CALL, 0, 1 };
+    uint32_t zero = 0;
+
+    write_pad(w, 8);
+    start = w->len;
+    write_bytes(w, fixed, sizeof(fixed));
+    write_bytes(w, &zero, sizeof(zero));    // body length, patched below
+    write_bytes(w, &serial, sizeof(serial));
+    write_bytes(w, &zero, sizeof(zero));    // header fields length, patched below
+    fieldsStart = w->len;
+
+    write_header_field(w, FIELD_PATH, "o", path);
+    write_header_field(w, FIELD_INTERFACE, "s", interface);
+    write_header_field(w, FIELD_MEMBER, "s", member);
+    write_header_field(w, FIELD_DESTINATION, "s", destination);
+    if (argCount > 0 && argCount < (int)sizeof(sig)) {
+        memset(sig, 's', argCount);
+        sig[argCount] = '\0';
+        write_header_field(w, FIELD_SIGNATURE, "g", sig);
+    }
+    fieldsLen = (uint32_t)(w->len - fieldsStart);
+    write_pad(w, 8);
+
+    bodyStart = w->len;
+    for (int i = 0; i < argCount; ++i) {
+        write_string(w, args[i]);
+    }
+    bodyLen = (uint32_t)(w->len - bodyStart);
+
+    if (w->ok) {
+        memcpy(w->data + start + 4, &bodyLen, sizeof(bodyLen));
+        memcpy(w->data + start + 12, &fieldsLen, sizeof(fieldsLen));
+    }
+}
+
+/*
+ * Reader
+ */
+
+static uint32_t swap32(uint32_t v)
+{
+    return __builtin_bswap32(v);
+}
+
+static int read_fixed(const WireValue *v, size_t *pos, size_t size, void *out)
+{
+    size_t p = align_up(*pos, size);
+
+    if (p + size > v->end) {
+        return 0;
+    }
+    memcpy(out, v->base + p, size);
+    if (v->swap) {
+        if (size == 2) {
+            uint16_t *x = out;
+            *x = __builtin_bswap16(*x);
+        } else if (size == 4) {
+            uint32_t *x = out;
+            *x = swap32(*x);
+        } else if (size == 8) {
+            uint64_t *x = out;
+            *x = __builtin_bswap64(*x);
+        }
+    }
+    *pos = p + size;
+    return 1;
+}
+
+/**
+ * Reads a string/object path (u32 length) or a signature (u8 length) at *pos
+ */
+static int read_string_at(const WireValue *v, size_t *pos, char type, const char **out)
+{
+    uint32_t len;
+
+    if (type == 'g') {
+        if (*pos >= v->end) {
+            return 0;
+        }
+        len = v->base[*pos];
+        *pos += 1;
+    } else if (!read_fixed(v, pos, 4, &len)) {
+        return 0;
+    }
+    if (len >= v->end - *pos || v->base[*pos + len] != '\0') {
+        return 0;
+    }
+    *out = (const char*)v->base + *pos;
+    *pos += len + 1;
+    return 1;
+}
+
+/**
+ * Advances a signature pointer past one complete type
+ */
+static int skip_signature(const char **sig, int depth)
+{
+    char type = **sig;
+    char close;
+
+    if (depth > WIRE_MAX_DEPTH || type == '\0') {
+        return 0;
+    }
+    (*sig)++;
+    if (type == 'a') {
+        return skip_signature(sig, depth + 1);
+    }
+    if (type == '(' || type == '{') {
+        close = type == '(' ? ')' : '}';
+        while (**sig != close) {
+            if (!skip_signature(sig, depth + 1)) {
+                return 0;
+            }
+        }
+        (*sig)++;
+    }
+    return 1;
+}
+
+/**
+ * Advances *pos past one value of type **sig (and *sig past that type)
+ */
+static int skip_value(const WireValue *v, size_t *pos, const char **sig, int depth)
+{
+    const char *str;
+    const char *typeStart = *sig;
+    char type = **sig;
+    uint32_t len;
+    uint64_t scratch;
+
+    if (depth > WIRE_MAX_DEPTH) {
+        return 0;
+    }
+    switch (type) {
+        case 'y':
+            (*sig)++;
+            return read_fixed(v, pos, 1, &scratch);
+        case 'n': case 'q':
+            (*sig)++;
+            return read_fixed(v, pos, 2, &scratch);
+        case 'b': case 'i': case 'u': case 'h':
+            (*sig)++;
+            return read_fixed(v, pos, 4, &scratch);
+        case 'x': case 't': case 'd':
+            (*sig)++;
+            return read_fixed(v, pos, 8, &scratch);
+        case 's': case 'o': case 'g':
+            (*sig)++;
+            return read_string_at(v, pos, type, &str);
+        case 'v': {
+            const char *inner;
+            (*sig)++;
+            if (!read_string_at(v, pos, 'g', &inner) || !skip_value(v, pos, &inner, depth + 1)) {
+                return 0;
+            }
+            return *inner == '\0';
+        }
+        case 'a':
+            if (!read_fixed(v, pos, 4, &len)) {
+                return 0;
+            }
+            *pos = align_up(*pos, type_alignment(typeStart[1]));
+            if (*pos > v->end || len > v->end - *pos) {
+                return 0;
+            }
+            *pos += len;
+            return skip_signature(sig, depth);
+        case '(':
+        case '{': {
+            char close = type == '(' ? ')' : '}';
+            *pos = align_up(*pos, 8);
+            (*sig)++;
+            while (**sig != close) {
+                if (!skip_value(v, pos, sig, depth + 1)) {
+                    return 0;
+                }
+            }
+            (*sig)++;
+            return *pos <= v->end;
+        }
+        default:
+            return 0;
+    }
+}
+
+char wire_value_type(const WireValue *value)
+{
+    return value->sig[0];
+}
+
+int wire_value_string(const WireValue *value, const char **out)
+{
+    size_t pos = value->pos;
+    char type = wire_value_type(value);
+
+    if (type != 's' && type != 'o' && type != 'g') {
+        return 0;
+    }
+    return read_string_at(value, &pos, type, out);
+}
+
+int wire_value_integer(const WireValue *value, int64_t *out)
+{
+    size_t pos = value->pos;
+    union { uint8_t y; int16_t n; uint16_t q; int32_t i; uint32_t u; int64_t x; uint64_t t; } v;
+
+    switch (wire_value_type(value)) {
+        case 'y': if (!read_fixed(value, &pos, 1, &v)) return 0; *out = v.y; return 1;
+        case 'n': if (!read_fixed(value, &pos, 2, &v)) return 0; *out = v.n; return 1;
+        case 'q': if (!read_fixed(value, &pos, 2, &v)) return 0; *out = v.q; return 1;
+        case 'i': if (!read_fixed(value, &pos, 4, &v)) return 0; *out = v.i; return 1;
+        case 'u': if (!read_fixed(value, &pos, 4, &v)) return 0; *out = v.u; return 1;
+        case 'x': if (!read_fixed(value, &pos, 8, &v)) return 0; *out = v.x; return 1;
+        case 't': if (!read_fixed(value, &pos, 8, &v)) return 0; *out = (int64_t)v.t; return 1;
+        default: return 0;
+    }
+}
+
+int wire_value_first_element(const WireValue *value, WireValue *element)
+{
+    size_t pos = value->pos;
+    uint32_t len;
+
+    if (wire_value_type(value) != 'a' || !read_fixed(value, &pos, 4, &len) || len == 0) {
+        return 0;
+    }
+    pos = align_up(pos, type_alignment(value->sig[1]));
+    if (pos > value->end || len > value->end - pos) {
+        return 0;
+    }
+    *element = *value;
+    element->pos = pos;
+    element->end = pos + len;
+    element->sig = value->sig + 1;
+    return 1;
+}
+
+int wire_dict_begin(const WireValue *value, WireDict *dict)
+{
+    size_t pos = value->pos;
+    uint32_t len;
+
+    if (strncmp(value->sig, "a{sv}", 5) != 0 || !read_fixed(value, &pos, 4, &len)) {
+        return 0;
+    }
+    pos = align_up(pos, 8);
+    if (pos > value->end || len > value->end - pos) {
+        return 0;
+    }
+    dict->cur = *value;
+    dict->cur.pos = pos;
+    dict->end = pos + len;
+    return 1;
+}
+
+int wire_dict_next(WireDict *dict, const char **key, WireValue *value)
+{
+    WireValue *cur = &dict->cur;
+    const char *inner, *sig;
+    size_t pos = align_up(cur->pos, 8);
+
+    if (pos >= dict->end || !read_string_at(cur, &pos, 's', key) || !read_string_at(cur, &pos, 'g', &inner)) {
+        return 0;
+    }
+    *value = *cur;
+    value->pos = pos;
+    value->end = dict->end;
+    value->sig = inner;
+
+    sig = inner;
+    if (!skip_value(cur, &pos, &sig, 0) || *sig != '\0' || pos > dict->end) {
+        return 0;
+    }
+    cur->pos = pos;
+    return 1;
+}
+
+/*
+ * Transport
+ */
+
+/**
+ * Extracts the socket address of the first usable unix: entry of a D-Bus address string
+ */
+static int parse_bus_address(const char *address, struct sockaddr_un *addr, socklen_t *addrLen)
+{
+    const char *entry = address;
+
+    while (entry != NULL && *entry != '\0') {
+        const char *end = strchr(entry, ';');
+        size_t entryLen = end != NULL ? (size_t)(end - entry) : strlen(entry);
+
+        if (entryLen > 5 && strncmp(entry, "unix:", 5) == 0) {
+            const char *kv = entry + 5;
+            const char *entryEnd = entry + entryLen;
+            while (kv < entryEnd) {
+                const char *comma = memchr(kv, ',', entryEnd - kv);
+                const char *kvEnd = comma != NULL ? comma : entryEnd;
+                int abstract = strncmp(kv, "abstract=", 9) == 0;
+                if (abstract || strncmp(kv, "path=", 5) == 0) {
+                    const char *v = kv + (abstract ? 9 : 5);
+                    size_t n = abstract ? 1 : 0;
+                    memset(addr, 0, sizeof(*addr));
+                    addr->sun_family = AF_UNIX;
+                    // Values may be %-escaped
+                    while (v < kvEnd && n < sizeof(addr->sun_path) - 1) {
+                        if (*v == '%' && kvEnd - v >= 3) {
+                            char hex[3] = { v[1], v[2], '\0' };
+                            addr->sun_path[n++] = (char)strtol(hex, NULL, 16);
+                            v += 3;
+                        } else {
+                            addr->sun_path[n++] = *v++;
+                        }
+                    }
+                    if (v != kvEnd) {
+                        return 0;
+                    }
+                    *addrLen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + n + (abstract ? 0 : 1));
+                    return 1;
+                }
+                kv = kvEnd + 1;
+            }
+        }
+        entry = end != NULL ? end + 1 : NULL;
+    }
+    return 0;
+}
+
+WireStatus wire_connect(WireConnection *conn)
+{
+    const char *address = getenv("DBUS_SESSION_BUS_ADDRESS");
+    struct sockaddr_un addr;
+    socklen_t addrLen;
+
+    conn->fd = -1;
+    conn->serial = 0;
+    conn->len = 0;
+    conn->errorName = NULL;
+    if (address == NULL || !parse_bus_address(address, &addr, &addrLen)) {
+        return WIRE_FAILED;
+    }
+    conn->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn->fd < 0) {
+        return WIRE_FAILED;
+    }
+    if (connect(conn->fd, (struct sockaddr*)&addr, addrLen) != 0) {
+        wire_close(conn);
+        return WIRE_FAILED;
+    }
+    return WIRE_OK;
+}
+
+void wire_close(WireConnection *conn)
+{
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+}
+
+static WireStatus write_all(int fd, const unsigned char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return WIRE_FAILED;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return WIRE_OK;
+}
+
+static int64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Reads more bytes into the connection buffer, waiting at most until `deadline` (a
+ * monotonic_ms() timestamp, or -1 to wait forever)
+ */
+static WireStatus read_more(WireConnection *conn, int64_t deadline)
+{
+    struct pollfd pfd = { conn->fd, POLLIN, 0 };
+    ssize_t n;
+    int ready;
+
+    if (conn->len >= WIRE_BUFFER_SIZE) {
+        return WIRE_FAILED;
+    }
+    do {
+        int64_t remaining = deadline < 0 ? -1 : deadline - monotonic_ms();
+        if (deadline >= 0 && remaining < 0) {
+            remaining = 0;
+        }
+        ready = poll(&pfd, 1, (int)(remaining > 0x7fffffff ? 0x7fffffff : remaining));
+    } while (ready < 0 && errno == EINTR);
+    if (ready == 0) {
+        return WIRE_TIMEOUT;
+    }
+    if (ready < 0) {
+        return WIRE_FAILED;
+    }
+    n = recv(conn->fd, conn->buf + conn->len, WIRE_BUFFER_SIZE - conn->len, 0);
+    if (n <= 0) {
+        return WIRE_FAILED;
+    }
+    conn->len += (size_t)n;
+    return WIRE_OK;
+}
+
+/**
+ * Parses the header fields of the message at the start of the buffer
+ */
+static int parse_header_fields(WireConnection *conn, int swap, uint32_t fieldsLen, uint32_t *replySerial,
+                               const char **signature)
+{
+    WireValue fields = { conn->buf, HEADER_FIXED_SIZE, HEADER_FIXED_SIZE + fieldsLen, swap, "" };
+    size_t pos = HEADER_FIXED_SIZE;
+
+    *replySerial = 0;
+    *signature = "";
+    conn->errorName = NULL;
+    while (align_up(pos, 8) < fields.end) {
+        const char *sig;
+        uint8_t code;
+
+        pos = align_up(pos, 8);
+        code = conn->buf[pos++];
+        if (!read_string_at(&fields, &pos, 'g', &sig)) {
+            return 0;
+        }
+        if (code == FIELD_REPLY_SERIAL && strcmp(sig, "u") == 0) {
+            if (!read_fixed(&fields, &pos, 4, replySerial)) {
+                return 0;
+            }
+        } else if (code == FIELD_SIGNATURE && strcmp(sig, "g") == 0) {
+            if (!read_string_at(&fields, &pos, 'g', signature)) {
+                return 0;
+            }
+        } else if (code == FIELD_ERROR_NAME && strcmp(sig, "s") == 0) {
+            if (!read_string_at(&fields, &pos, 's', &conn->errorName)) {
+                return 0;
+            }
+        } else if (!skip_value(&fields, &pos, &sig, 0) || *sig != '\0') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Receives messages until the reply to `serial` is at the start of the buffer
+ */
+static WireStatus wait_reply(WireConnection *conn, uint32_t serial, int64_t deadline, WireValue *body,
+                             const char **signature, int *isError)
+{
+    WireStatus status;
+
+    while (1) {
+        uint32_t bodyLen, msgSerial, fieldsLen, replySerial;
+        size_t headerLen, total;
+        int swap;
+
+        while (conn->len < HEADER_FIXED_SIZE) {
+            if ((status = read_more(conn, deadline)) != WIRE_OK) {
+                return status;
+            }
+        }
+        if (conn->buf[0] != 'l' && conn->buf[0] != 'B') {
+            return WIRE_FAILED;
+        }
+        swap = conn->buf[0] != NATIVE_ENDIAN;
+        memcpy(&bodyLen, conn->buf + 4, 4);
+        memcpy(&msgSerial, conn->buf + 8, 4);
+        memcpy(&fieldsLen, conn->buf + 12, 4);
+        if (swap) {
+            bodyLen = swap32(bodyLen);
+            fieldsLen = swap32(fieldsLen);
+        }
+        headerLen = align_up(HEADER_FIXED_SIZE + (size_t)fieldsLen, 8);
+        total = headerLen + bodyLen;
+        if (fieldsLen > WIRE_BUFFER_SIZE || total > WIRE_BUFFER_SIZE) {
+            return WIRE_FAILED;
+        }
+        while (conn->len < total) {
+            if ((status = read_more(conn, deadline)) != WIRE_OK) {
+                return status;
+            }
+        }
+        if (!parse_header_fields(conn, swap, fieldsLen, &replySerial, signature)) {
+            return WIRE_FAILED;
+        }
+        if ((conn->buf[1] == MESSAGE_METHOD_RETURN || conn->buf[1] == MESSAGE_ERROR) && replySerial == serial) {
+            body->base = conn->buf + headerLen;
+            body->pos = 0;
+            body->end = bodyLen;
+            body->swap = swap;
+            body->sig = *signature;
+            *isError = conn->buf[1] == MESSAGE_ERROR;
+            return WIRE_OK;
+        }
+        // Not ours (Hello reply, NameAcquired...): drop it
+        memmove(conn->buf, conn->buf + total, conn->len - total);
+        conn->len -= total;
+    }
+}
+
+WireStatus wire_get_property(WireConnection *conn, const char *destination, const char *path,
+                             const char *interface, const char *property, int timeoutMs,
+                             WireValue *value)
+{
+    unsigned char out[1024];
+    WireWriter w = { out, 0, sizeof(out), 1 };
+    const char *args[2] = { interface, property };
+    const char *signature;
+    char auth[64];
+    unsigned uid = (unsigned)getuid();
+    char uidStr[16];
+    WireValue body;
+    WireStatus status;
+    int isError;
+    char *lineEnd;
+    size_t authLen = 0;
+    int64_t deadline = timeoutMs < 0 ? -1 : monotonic_ms() + timeoutMs;
+
+    // AUTH EXTERNAL takes the uid as hex-encoded ASCII decimal
+    snprintf(uidStr, sizeof(uidStr), "%u", uid);
+    authLen = (size_t)snprintf(auth, sizeof(auth), "%cAUTH EXTERNAL ", '\0');
+    for (const char *c = uidStr; *c != '\0' && authLen + 3 < sizeof(auth); ++c) {
+        authLen += (size_t)snprintf(auth + authLen, sizeof(auth) - authLen, "%02x", (unsigned char)*c);
+    }
+    authLen += (size_t)snprintf(auth + authLen, sizeof(auth) - authLen, "\r\nBEGIN\r\n");
+    write_bytes(&w, auth, authLen);
+
+    // Messages must start 8-aligned relative to their own start only, so pad relative to it
+    size_t messagesStart = w.len;
+    WireWriter msgs = { out + messagesStart, 0, sizeof(out) - messagesStart, 1 };
+    write_method_call(&msgs, ++conn->serial, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                      "org.freedesktop.DBus", "Hello", NULL, 0);
+    write_method_call(&msgs, ++conn->serial, destination, path, "org.freedesktop.DBus.Properties",
+                      "Get", args, 2);
+    if (!w.ok || !msgs.ok) {
+        return WIRE_FAILED;
+    }
+    if ((status = write_all(conn->fd, out, messagesStart + msgs.len)) != WIRE_OK) {
+        return status;
+    }
+
+    // Server answers "OK <guid>\r\n" then switches to the binary protocol
+    while ((lineEnd = memchr(conn->buf, '\n', conn->len)) == NULL) {
+        if ((status = read_more(conn, deadline)) != WIRE_OK) {
+            return status;
+        }
+    }
+    if (conn->len < 3 || strncmp((char*)conn->buf, "OK ", 3) != 0) {
+        return WIRE_FAILED;
+    }
+    size_t consumed = (size_t)((unsigned char*)lineEnd - conn->buf) + 1;
+    memmove(conn->buf, conn->buf + consumed, conn->len - consumed);
+    conn->len -= consumed;
+
+    if ((status = wait_reply(conn, conn->serial, deadline, &body, &signature, &isError)) != WIRE_OK) {
+        return status;
+    }
+    if (isError) {
+        return conn->errorName != NULL ? WIRE_ERROR_REPLY : WIRE_FAILED;
+    }
+    if (strcmp(signature, "v") != 0) {
+        return WIRE_FAILED;
+    }
+    // Step into the variant
+    size_t pos = 0;
+    const char *inner;
+    if (!read_string_at(&body, &pos, 'g', &inner)) {
+        return WIRE_FAILED;
+    }
+    *value = body;
+    value->pos = pos;
+    value->sig = inner;
+    return WIRE_OK;
+}
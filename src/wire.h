@@ -0,0 +1,107 @@
+#ifndef SPOTIFY_DBUS_WIRE_H
+#define SPOTIFY_DBUS_WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Minimal D-Bus client speaking the wire protocol directly over the session bus socket.
+ *
+ * It only knows how to authenticate (EXTERNAL), say Hello and make a single method call, which
+ * is all the read-only hot path (`track`) needs. Replies are parsed in place: strings handed
+ * out point into the connection buffer and stay valid until the connection is reused.
+ */
+
+#define WIRE_BUFFER_SIZE 65536
+#define WIRE_MAX_DEPTH 16
+
+typedef enum {
+    WIRE_OK,
+    WIRE_TIMEOUT,
+    WIRE_ERROR_REPLY,
+    WIRE_FAILED
+} WireStatus;
+
+typedef struct {
+    int fd;
+    uint32_t serial;
+    size_t len;
+    const char *errorName;
+    unsigned char buf[WIRE_BUFFER_SIZE];
+} WireConnection;
+
+/**
+ * A marshalled value inside a received message
+ *
+ * `sig` points at the value type in a signature; only its first complete type is relevant.
+ */
+typedef struct {
+    const unsigned char *base;
+    size_t pos;
+    size_t end;
+    int swap;
+    const char *sig;
+} WireValue;
+
+/**
+ * Cursor over the entries of an a{sv} dict
+ */
+typedef struct {
+    WireValue cur;
+    size_t end;
+} WireDict;
+
+/**
+ * Connects to the session bus (DBUS_SESSION_BUS_ADDRESS, unix:path= or unix:abstract= only)
+ */
+WireStatus wire_connect(WireConnection *conn);
+
+/**
+ * Authenticates, registers with Hello and calls org.freedesktop.DBus.Properties.Get, all in a
+ * single pipelined write, then waits for the Get reply.
+ *
+ * @param timeoutMs Deadline for the whole exchange, negative to wait forever
+ * @param value     Set to the property value (the variant contents) on WIRE_OK
+ * @return WIRE_ERROR_REPLY with conn->errorName set when the call returned a D-Bus error
+ */
+WireStatus wire_get_property(WireConnection *conn, const char *destination, const char *path,
+                             const char *interface, const char *property, int timeoutMs,
+                             WireValue *value);
+
+void wire_close(WireConnection *conn);
+
+/**
+ * D-Bus type code of a value (e.g. 's', 'a')
+ */
+char wire_value_type(const WireValue *value);
+
+/**
+ * Reads a string, object path or signature, without copying it
+ */
+int wire_value_string(const WireValue *value, const char **out);
+
+/**
+ * Reads any integer type as an int64_t
+ */
+int wire_value_integer(const WireValue *value, int64_t *out);
+
+/**
+ * Positions `element` on the first element of an array
+ *
+ * @return 1 if the array is not empty, 0 otherwise
+ */
+int wire_value_first_element(const WireValue *value, WireValue *element);
+
+/**
+ * Starts iterating over an a{sv} dict
+ */
+int wire_dict_begin(const WireValue *value, WireDict *dict);
+
+/**
+ * Reads the next dict entry: `key` points into the message and `value` is the variant contents
+ *
+ * @return 1 while entries remain, 0 at the end of the dict or on malformed data
+ */
+int wire_dict_next(WireDict *dict, const char **key, WireValue *value);
+
+#endif
@@ -0,0 +1,77 @@
+#!/bin/sh
+#
+# Checks that the resident modes print metadata updates that keep the trackid (the mock player's
+# Retag method changes the artist only), in every output format, against a private dbus-daemon
+# serving the mock player; then that they end cleanly on a replayed capture of those updates.
+#
+# usage: tools/follow-test.sh   (run `make && make tools` first)
+
+set -e
+
+BIN=${BIN:-build/spotify-dbus}
+MOCK=${MOCK:-build/mock-player}
+
+. "$(dirname "$0")/mock-env.sh"
+
+failures=0
+
+# Runs `spotify-dbus OPTIONS... COMMAND...` in the background, retags the current track & checks
+# that the new artist shows up in the output
+check_retag() {
+    name=$1
+    shift
+    : >"$TMP/out"
+    "$BIN" "$@" >>"$TMP/out" 2>&1 &
+    SERVE_PID=$!
+    tries=0
+    until [ -s "$TMP/out" ]; do
+        tries=$((tries + 1))
+        if [ $tries -gt 100 ]; then
+            break
+        fi
+        sleep 0.05
+    done
+    # Synchronous (--print-reply), so that the signal is sent by the time it returns
+    dbus-send --session --print-reply --dest=org.mpris.MediaPlayer2.spotify \
+        /org/mpris/MediaPlayer2 org.mpris.MediaPlayer2.Player.Retag >/dev/null
+    sleep 0.3
+    kill $SERVE_PID
+    wait $SERVE_PID 2>/dev/null || true
+    SERVE_PID=
+    if grep -q "Retagged Artist" "$TMP/out"; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name: the retagged artist was not printed" >&2
+        failures=$((failures + 1))
+    fi
+    # Back to the original artist for the next check
+    dbus-send --session --print-reply --dest=org.mpris.MediaPlayer2.spotify \
+        /org/mpris/MediaPlayer2 org.mpris.MediaPlayer2.Player.Retag >/dev/null
+}
+
+check_retag "follow" follow
+check_retag "follow --json" --json follow
+check_retag "follow --pango" --pango follow
+check_retag "follow --max-width" --max-width 40 follow
+check_retag "track --marquee" track --marquee 80
+check_retag "track --marquee (scrolling)" track --marquee 16 --speed 50
+
+# Replays the signals recorded by the mock player so far (the retags above): the resident modes
+# must print the last state & exit cleanly when the capture ends
+check_replay() {
+    name=$1
+    shift
+    if "$BIN" --replay "$TMP/capture" "$@" >"$TMP/out" 2>&1 && [ -s "$TMP/out" ]; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name: $(cat "$TMP/out")" >&2
+        failures=$((failures + 1))
+    fi
+}
+
+check_replay "--replay follow" follow
+check_replay "--replay follow --json" --json follow
+check_replay "--replay track --marquee" track --marquee 80
+check_replay "--replay wait" wait
+
+[ $failures -eq 0 ]
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+#
+# Generates src/width_tables.h, the per-code-point display width & grapheme cluster break
+# tables used by src/width.c, from the Unicode database bundled with Python (unicodedata).
+#
+# Widths follow wcwidth: 2 for East Asian Wide/Fullwidth, 0 for combining marks, format &
+# control characters and conjoining Hangul vowels/trailing consonants, 1 otherwise (Ambiguous
+# included). The grapheme break properties are derived from the general categories plus the
+# short explicit lists below, which covers UAX #29 for everything a track title realistically
+# contains.
+#
+# usage: tools/gen-width-tables.py > src/width_tables.h
+
+import sys
+import unicodedata
+
+MAX_CODE_POINT = 0x10FFFF
+BLOCK_SHIFT = 7
+BLOCK_SIZE = 1 << BLOCK_SHIFT
+
+# Must match GraphemeBreak in src/width.h
+GCB = ["OTHER", "CR", "LF", "CONTROL", "EXTEND", "ZWJ", "REGIONAL_INDICATOR", "PREPEND",
+       "SPACING_MARK", "L", "V", "T", "LV", "LVT"]
+GCB_INDEX = {name: i for i, name in enumerate(GCB)}
+PICTOGRAPHIC_BIT = 0x10
+WIDTH_SHIFT = 5
+
+EXTEND_EXTRA = [(0x200C, 0x200C), (0xFF9E, 0xFF9F), (0x1F3FB, 0x1F3FF), (0xE0020, 0xE007F)]
+SPACING_MARK_EXTRA = [(0x0E33, 0x0E33), (0x0EB3, 0x0EB3)]
+PREPEND = [(0x0600, 0x0605), (0x06DD, 0x06DD), (0x070F, 0x070F), (0x0890, 0x0891), (0x08E2, 0x08E2),
+           (0x0D4E, 0x0D4E), (0x110BD, 0x110BD), (0x110CD, 0x110CD), (0x111C2, 0x111C3)]
+PICTOGRAPHIC = [(0x00A9, 0x00A9), (0x00AE, 0x00AE), (0x203C, 0x203C), (0x2049, 0x2049),
+                (0x2122, 0x2122), (0x2139, 0x2139), (0x2194, 0x2199), (0x21A9, 0x21AA),
+                (0x231A, 0x231B), (0x2328, 0x2328), (0x2388, 0x2388), (0x23CF, 0x23CF),
+                (0x23E9, 0x23F3), (0x23F8, 0x23FA), (0x24C2, 0x24C2), (0x25AA, 0x25AB),
+                (0x25B6, 0x25B6), (0x25C0, 0x25C0), (0x25FB, 0x25FE), (0x2600, 0x27BF),
+                (0x2934, 0x2935), (0x2B05, 0x2B07), (0x2B1B, 0x2B1C), (0x2B50, 0x2B50),
+                (0x2B55, 0x2B55), (0x3030, 0x3030), (0x303D, 0x303D), (0x3297, 0x3297),
+                (0x3299, 0x3299), (0x1F000, 0x1F0FF), (0x1F10D, 0x1F10F), (0x1F12F, 0x1F12F),
+                (0x1F16C, 0x1F171), (0x1F17E, 0x1F17F), (0x1F18E, 0x1F18E), (0x1F191, 0x1F19A),
+                (0x1F1AD, 0x1F1E5), (0x1F201, 0x1F20F), (0x1F21A, 0x1F21A), (0x1F22F, 0x1F22F),
+                (0x1F232, 0x1F23A), (0x1F23C, 0x1F23F), (0x1F249, 0x1F3FA), (0x1F400, 0x1F53D),
+                (0x1F546, 0x1F64F), (0x1F680, 0x1F6FF), (0x1F774, 0x1F77F), (0x1F7D5, 0x1F7FF),
+                (0x1F80C, 0x1F80F), (0x1F848, 0x1F84F), (0x1F85A, 0x1F85F), (0x1F888, 0x1F88F),
+                (0x1F8AE, 0x1F8FF), (0x1F90C, 0x1F93A), (0x1F93C, 0x1F945), (0x1F947, 0x1FAFF),
+                (0x1FC00, 0x1FFFD)]
+
+
+def in_ranges(cp, ranges):
+    return any(first <= cp <= last for first, last in ranges)
+
+
+def grapheme_break(cp, category):
+    if cp == 0x0D:
+        return "CR"
+    if cp == 0x0A:
+        return "LF"
+    if cp == 0x200D:
+        return "ZWJ"
+    if 0x1F1E6 <= cp <= 0x1F1FF:
+        return "REGIONAL_INDICATOR"
+    if in_ranges(cp, PREPEND):
+        return "PREPEND"
+    if category in ("Mn", "Me") or in_ranges(cp, EXTEND_EXTRA):
+        return "EXTEND"
+    if category == "Mc" or in_ranges(cp, SPACING_MARK_EXTRA):
+        return "SPACING_MARK"
+    if category in ("Cc", "Zl", "Zp") or (category == "Cf" and cp != 0x00AD):
+        return "CONTROL"
+    if 0x1100 <= cp <= 0x115F or 0xA960 <= cp <= 0xA97C:
+        return "L"
+    if 0x1160 <= cp <= 0x11A7 or 0xD7B0 <= cp <= 0xD7C6:
+        return "V"
+    if 0x11A8 <= cp <= 0x11FF or 0xD7CB <= cp <= 0xD7FB:
+        return "T"
+    if 0xAC00 <= cp <= 0xD7A3:
+        return "LV" if (cp - 0xAC00) % 28 == 0 else "LVT"
+    return "OTHER"
+
+
+def display_width(cp, category):
+    if cp == 0x00AD:
+        return 1
+    if category in ("Mn", "Me", "Cf", "Cc", "Zl", "Zp"):
+        return 0
+    if 0x1160 <= cp <= 0x11FF or 0xD7B0 <= cp <= 0xD7FF:
+        return 0
+    if unicodedata.east_asian_width(chr(cp)) in ("W", "F"):
+        return 2
+    return 1
+
+
+def properties(cp):
+    if 0xD800 <= cp <= 0xDFFF:
+        return GCB_INDEX["CONTROL"]
+    category = unicodedata.category(chr(cp))
+    value = GCB_INDEX[grapheme_break(cp, category)] | display_width(cp, category) << WIDTH_SHIFT
+    if in_ranges(cp, PICTOGRAPHIC):
+        value |= PICTOGRAPHIC_BIT
+    return value
+
+
+def main():
+    blocks, block_index, stage1 = [], {}, []
+    for start in range(0, MAX_CODE_POINT + 1, BLOCK_SIZE):
+        block = tuple(properties(cp) for cp in range(start, start + BLOCK_SIZE))
+        if block not in block_index:
+            block_index[block] = len(blocks)
+            blocks.append(block)
+        stage1.append(block_index[block])
+    index_type = "uint8_t" if len(blocks) <= 256 else "uint16_t"
+
+    out = sys.stdout
+    out.write("// Generated by tools/gen-width-tables.py from Unicode %s: do not edit\n\n"
+              % unicodedata.unidata_version)
+    out.write("#ifndef SPOTIFY_DBUS_WIDTH_TABLES_H\n#define SPOTIFY_DBUS_WIDTH_TABLES_H\n\n")
+    out.write("#include <stdint.h>\n\n")
+    out.write("#define CHAR_BLOCK_SHIFT %d\n\n" % BLOCK_SHIFT)
+    out.write("// Block of each run of %d code points in char_property_blocks\n" % BLOCK_SIZE)
+    out.write("static const %s char_block_index[%d] = {\n" % (index_type, len(stage1)))
+    for i in range(0, len(stage1), 16):
+        out.write("    " + ", ".join(str(v) for v in stage1[i:i + 16]) + ",\n")
+    out.write("};\n\n")
+    out.write("// CHAR_WIDTH << 5 | CHAR_PICTOGRAPHIC | GraphemeBreak, per code point\n")
+    out.write("static const uint8_t char_property_blocks[%d][%d] = {\n" % (len(blocks), BLOCK_SIZE))
+    for block in blocks:
+        out.write("    {\n")
+        for i in range(0, BLOCK_SIZE, 16):
+            out.write("        " + ", ".join("0x%02x" % v for v in block[i:i + 16]) + ",\n")
+        out.write("    },\n")
+    out.write("};\n\n#endif\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,46 @@
+# Sourced by the benchmark scripts: starts a private dbus-daemon and the mock player (recording
+# a capture file into $TMP/capture for `--replay`), waits for the player to show up, and defines
+# `measure`. Everything is torn down on exit.
+#
+# Expects BIN (a spotify-dbus binary) and MOCK to be set.
+
+if [ ! -x "$BIN" ] || [ ! -x "$MOCK" ]; then
+    echo "$BIN or $MOCK missing: run \`make && make tools\` first" >&2
+    exit 1
+fi
+TMP=$(mktemp -d)
+
+dbus-daemon --session --fork --print-address=3 --print-pid=4 3>"$TMP/address" 4>"$TMP/pid"
+DBUS_SESSION_BUS_ADDRESS=$(cat "$TMP/address")
+export DBUS_SESSION_BUS_ADDRESS
+XDG_RUNTIME_DIR=$TMP
+export XDG_RUNTIME_DIR
+
+"$MOCK" -c "$TMP/capture" &
+MOCK_PID=$!
+SERVE_PID=
+trap 'kill $MOCK_PID $SERVE_PID; kill $(cat "$TMP/pid"); rm -rf "$TMP"' EXIT
+trap 'exit 1' INT TERM
+
+# Wait for the mock player to own its name
+tries=0
+until "$BIN" --libdbus track >/dev/null 2>&1; do
+    tries=$((tries + 1))
+    if [ $tries -gt 100 ]; then
+        echo "mock player did not show up on the bus" >&2
+        exit 1
+    fi
+    sleep 0.05
+done
+
+# Prints the mean wall-clock time of RUNS executions of the given command, in microseconds
+measure() {
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$@" >/dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    echo $(( (end - start) / RUNS / 1000 ))
+}
@@ -0,0 +1,265 @@
+/*
+ * Mock MPRIS player owning org.mpris.MediaPlayer2.spotify, for benchmarks & manual testing
+ * without Spotify.
+ *
+ * usage: mock-player [-d DELAY_MS] [-v] [-c FILE]
+ *   -d DELAY_MS   wait DELAY_MS before answering each call (simulates a stalled UI thread)
+ *   -v            log every call on stderr
+ *   -c FILE       record the Properties.Get replies & signals sent into a capture file, for
+ *                 `spotify-dbus --replay FILE`
+ *
+ * It serves Properties.Get (Metadata, PlaybackStatus, Volume, Position), Properties.Set (Volume),
+ * PlayPause/Next/Previous/Seek/SetPosition, and emits PropertiesChanged like Spotify does.
+ *
+ * Retag (a mock-only method, on any interface) changes the artist of the current track without
+ * changing its trackid, as Spotify does when it fixes up metadata after a track change.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dbus/dbus.h>
+
+#include "../src/backend.h"
+
+static int track = 0;
+static int playing = 1;
+static double volume = 0.5;
+static int64_t position = 0;
+static int retagged = 0;
+static int delay_ms = 0;
+static int verbose = 0;
+static FILE *capture = NULL;
+
+static const char *titles[] = { "Song & \"Quotes\" <b>", "日本語のタイトル 🎵", "Plain Title" };
+static const char *artists[] = { "Artist One", "アーティスト", "Third" };
+static const char *retagged_artist = "Retagged Artist";
+
+/**
+ * Sends a message, recording it in the capture file (if any) once it got its serial
+ */
+static void send_message(DBusConnection *conn, DBusMessage *msg, CaptureKind kind, const char *name)
+{
+    dbus_connection_send(conn, msg, NULL);
+    if (capture != NULL && !capture_write_record(capture, kind, name, msg)) {
+        perror("mock: cannot write the capture");
+    }
+}
+
+/**
+ * Appends a {sv} entry holding a basic value to a metadata dict
+ */
+static void add_entry(DBusMessageIter *dict, const char *key, int type, const char *sig, const void *val)
+{
+    DBusMessageIter e, v;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &e);
+    dbus_message_iter_append_basic(&e, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&e, DBUS_TYPE_VARIANT, sig, &v);
+    dbus_message_iter_append_basic(&v, type, val);
+    dbus_message_iter_close_container(&e, &v);
+    dbus_message_iter_close_container(dict, &e);
+}
+
+/**
+ * Appends a {sv} entry holding a string array to a metadata dict
+ */
+static void add_strarray(DBusMessageIter *dict, const char *key, const char **vals, int n)
+{
+    DBusMessageIter e, v, a;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &e);
+    dbus_message_iter_append_basic(&e, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&e, DBUS_TYPE_VARIANT, "as", &v);
+    dbus_message_iter_open_container(&v, DBUS_TYPE_ARRAY, "s", &a);
+    for (int i = 0; i < n; i++) {
+        dbus_message_iter_append_basic(&a, DBUS_TYPE_STRING, &vals[i]);
+    }
+    dbus_message_iter_close_container(&v, &a);
+    dbus_message_iter_close_container(&e, &v);
+    dbus_message_iter_close_container(dict, &e);
+}
+
+/**
+ * Appends the a{sv} metadata of the current track, shaped like Spotify's
+ */
+static void append_metadata(DBusMessageIter *it)
+{
+    DBusMessageIter dict;
+    char trackid[64];
+    const char *tid = trackid;
+    const char *artUrl = "https://i.scdn.co/image/ab67616d0000b273";
+    const char *album = "Album Name";
+    const char *url = "https://open.spotify.com/track/xyz";
+    const char *as[2] = { retagged ? retagged_artist : artists[track % 3], "Featured Artist" };
+    uint64_t length = 215000000 + track;
+    int32_t tn = track + 1, dn = 1;
+    double rating = 0.25;
+    snprintf(trackid, sizeof(trackid), "/com/spotify/track/%d", track);
+    dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    add_entry(&dict, "mpris:trackid", DBUS_TYPE_OBJECT_PATH, "o", &tid);
+    add_entry(&dict, "mpris:length", DBUS_TYPE_UINT64, "t", &length);
+    add_entry(&dict, "mpris:artUrl", DBUS_TYPE_STRING, "s", &artUrl);
+    add_entry(&dict, "xesam:album", DBUS_TYPE_STRING, "s", &album);
+    add_strarray(&dict, "xesam:albumArtist", as, 1);
+    add_strarray(&dict, "xesam:artist", as, 2);
+    add_entry(&dict, "xesam:autoRating", DBUS_TYPE_DOUBLE, "d", &rating);
+    add_entry(&dict, "xesam:discNumber", DBUS_TYPE_INT32, "i", &dn);
+    add_entry(&dict, "xesam:title", DBUS_TYPE_STRING, "s", &titles[track % 3]);
+    add_entry(&dict, "xesam:trackNumber", DBUS_TYPE_INT32, "i", &tn);
+    add_entry(&dict, "xesam:url", DBUS_TYPE_STRING, "s", &url);
+    dbus_message_iter_close_container(it, &dict);
+}
+
+/**
+ * Appends the value of a Player property, wrapped in a variant
+ */
+static void append_prop(DBusMessageIter *it, const char *prop)
+{
+    DBusMessageIter v;
+    if (strcmp(prop, "Metadata") == 0) {
+        dbus_message_iter_open_container(it, DBUS_TYPE_VARIANT, "a{sv}", &v);
+        append_metadata(&v);
+    } else if (strcmp(prop, "PlaybackStatus") == 0) {
+        const char *st = playing ? "Playing" : "Paused";
+        dbus_message_iter_open_container(it, DBUS_TYPE_VARIANT, "s", &v);
+        dbus_message_iter_append_basic(&v, DBUS_TYPE_STRING, &st);
+    } else if (strcmp(prop, "Volume") == 0) {
+        dbus_message_iter_open_container(it, DBUS_TYPE_VARIANT, "d", &v);
+        dbus_message_iter_append_basic(&v, DBUS_TYPE_DOUBLE, &volume);
+    } else {
+        dbus_message_iter_open_container(it, DBUS_TYPE_VARIANT, "x", &v);
+        dbus_message_iter_append_basic(&v, DBUS_TYPE_INT64, &position);
+    }
+    dbus_message_iter_close_container(it, &v);
+}
+
+/**
+ * Emits PropertiesChanged for a single Player property
+ */
+static void emit_changed(DBusConnection *conn, const char *prop)
+{
+    DBusMessage *sig = dbus_message_new_signal("/org/mpris/MediaPlayer2",
+        "org.freedesktop.DBus.Properties", "PropertiesChanged");
+    DBusMessageIter it, dict, e, inv;
+    const char *iface = "org.mpris.MediaPlayer2.Player";
+    dbus_message_iter_init_append(sig, &it);
+    dbus_message_iter_append_basic(&it, DBUS_TYPE_STRING, &iface);
+    dbus_message_iter_open_container(&it, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &e);
+    dbus_message_iter_append_basic(&e, DBUS_TYPE_STRING, &prop);
+    append_prop(&e, prop);
+    dbus_message_iter_close_container(&dict, &e);
+    dbus_message_iter_close_container(&it, &dict);
+    dbus_message_iter_open_container(&it, DBUS_TYPE_ARRAY, "s", &inv);
+    dbus_message_iter_close_container(&it, &inv);
+    send_message(conn, sig, CAPTURE_SIGNAL, "PropertiesChanged");
+    dbus_message_unref(sig);
+}
+
+/**
+ * Handles one method call, updating the player state & emitting signals like Spotify does
+ */
+static void handle_call(DBusConnection *conn, DBusMessage *msg)
+{
+    const char *member = dbus_message_get_member(msg);
+    DBusMessage *reply = dbus_message_new_method_return(msg);
+    DBusMessageIter it, v;
+    const char *prop = NULL;
+
+    if (verbose) fprintf(stderr, "mock: %s\n", member);
+    if (strcmp(member, "Get") == 0) {
+        const char *iface;
+        if (dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &iface, DBUS_TYPE_STRING, &prop, DBUS_TYPE_INVALID)) {
+            dbus_message_iter_init_append(reply, &it);
+            append_prop(&it, prop);
+        }
+    } else if (strcmp(member, "Set") == 0) {
+        dbus_message_iter_init(msg, &it);
+        dbus_message_iter_next(&it);
+        dbus_message_iter_next(&it);
+        dbus_message_iter_recurse(&it, &v);
+        if (dbus_message_iter_get_arg_type(&v) == DBUS_TYPE_DOUBLE) {
+            dbus_message_iter_get_basic(&v, &volume);
+            if (verbose) fprintf(stderr, "mock: volume=%f\n", volume);
+            emit_changed(conn, "Volume");
+        }
+    } else if (strcmp(member, "Next") == 0 || strcmp(member, "Previous") == 0) {
+        track += strcmp(member, "Next") == 0 ? 1 : 2;
+        retagged = 0;
+        emit_changed(conn, "Metadata");
+    } else if (strcmp(member, "Retag") == 0) {
+        retagged = !retagged;
+        emit_changed(conn, "Metadata");
+    } else if (strcmp(member, "PlayPause") == 0) {
+        playing = !playing;
+        emit_changed(conn, "PlaybackStatus");
+    } else if (strcmp(member, "Seek") == 0) {
+        int64_t offset;
+        if (dbus_message_get_args(msg, NULL, DBUS_TYPE_INT64, &offset, DBUS_TYPE_INVALID)) {
+            position += offset;
+            if (verbose) fprintf(stderr, "mock: seek %lld\n", (long long)offset);
+        }
+    } else if (strcmp(member, "SetPosition") == 0) {
+        const char *trackId;
+        int64_t newPosition;
+        if (dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &trackId, DBUS_TYPE_INT64, &newPosition,
+                                  DBUS_TYPE_INVALID)) {
+            position = newPosition;
+            if (verbose) fprintf(stderr, "mock: setpos %s %lld\n", trackId, (long long)newPosition);
+        }
+    }
+    if (!dbus_message_get_no_reply(msg)) {
+        if (prop != NULL) {
+            send_message(conn, reply, CAPTURE_PROPERTY_REPLY, prop);
+        } else {
+            dbus_connection_send(conn, reply, NULL);
+        }
+    }
+    dbus_message_unref(reply);
+}
+
+int main(int argc, char **argv)
+{
+    DBusError err;
+    DBusConnection *conn;
+    DBusMessage *msg;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            delay_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            capture = capture_create(argv[++i]);
+            if (capture == NULL) {
+                perror(argv[i]);
+                return 1;
+            }
+        }
+    }
+
+    dbus_error_init(&err);
+    conn = dbus_bus_get(DBUS_BUS_SESSION, &err);
+    if (conn == NULL) {
+        fprintf(stderr, "ERROR: %s\n", err.message);
+        return 1;
+    }
+    dbus_bus_request_name(conn, "org.mpris.MediaPlayer2.spotify", DBUS_NAME_FLAG_DO_NOT_QUEUE, &err);
+    if (dbus_error_is_set(&err)) {
+        fprintf(stderr, "ERROR: %s\n", err.message);
+        return 1;
+    }
+
+    while (dbus_connection_read_write(conn, -1)) {
+        while ((msg = dbus_connection_pop_message(conn)) != NULL) {
+            if (dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_METHOD_CALL) {
+                if (delay_ms > 0) {
+                    usleep(delay_ms * 1000);
+                }
+                handle_call(conn, msg);
+            }
+            dbus_message_unref(msg);
+        }
+    }
+    return 0;
+}
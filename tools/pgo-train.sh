@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# PGO training workload, run by `make pgo` with the instrumented binary: one-shot commands
+# against the mock player (both transports, controls), then the in-process decode benchmarks
+# over the capture the mock recorded meanwhile.
+#
+# usage: tools/pgo-train.sh BIN [ROUNDS]
+
+set -e
+
+BIN=$1
+ROUNDS=${2:-30}
+MOCK=${MOCK:-build/mock-player}
+
+. "$(dirname "$0")/mock-env.sh"
+
+round=0
+while [ $round -lt "$ROUNDS" ]; do
+    "$BIN" track
+    "$BIN" --libdbus track
+    "$BIN" metadata
+    "$BIN" --window 0 next
+    "$BIN" --window 0 prev
+    "$BIN" --window 0 volume +1
+    "$BIN" --window 0 seek 1
+    "$BIN" p
+    round=$((round + 1))
+done >/dev/null
+
+"$BIN" --replay "$TMP/capture" bench backend -n 20000 >/dev/null
+"$BIN" --replay "$TMP/capture" bench metadata -n 2000 >/dev/null
+"$BIN" --replay "$TMP/capture" bench track -n 2000 >/dev/null
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Compares the exec-to-exit latency of `spotify-dbus track` through the built-in wire client and
+# through libdbus, against a private dbus-daemon serving the mock player, and of
+# spotify-dbus-client against `spotify-dbus serve` when the client was built (`make client`).
+#
+# usage: tools/startup-bench.sh [RUNS]   (run `make && make tools` first)
+
+set -e
+
+RUNS=${1:-200}
+BIN=${BIN:-build/spotify-dbus}
+MOCK=${MOCK:-build/mock-player}
+CLIENT=${CLIENT:-build/spotify-dbus-client}
+
+. "$(dirname "$0")/mock-env.sh"
+
+echo "spotify-dbus track, mean of $RUNS runs (exec to exit):"
+echo "  wire client: $(measure "$BIN" track) us"
+echo "  libdbus:     $(measure "$BIN" --libdbus track) us"
+
+if [ -x "$CLIENT" ]; then
+    "$BIN" serve &
+    SERVE_PID=$!
+    tries=0
+    until "$CLIENT" track >/dev/null 2>&1; do
+        tries=$((tries + 1))
+        if [ $tries -gt 100 ]; then
+            echo "spotify-dbus serve did not start" >&2
+            exit 1
+        fi
+        sleep 0.05
+    done
+    echo "  socket client (serve): $(measure "$CLIENT" track) us"
+fi
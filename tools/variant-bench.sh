@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Reports the startup & decode latency of every build variant present in build/ (plain, -O2,
+# -O3 & PGO, see the Makefile):
+#  - startup: mean exec-to-exit time of `track` against the mock player
+#  - decode: p50 of fetching & decoding the recorded Metadata reply into a TrackInfo
+#    (`bench backend`), and of flattening it into a MetadataArray (`bench metadata`), replayed
+#    from a capture of the mock
+#
+# usage: tools/variant-bench.sh [RUNS]   (run `make variants && make tools` first)
+
+set -e
+
+RUNS=${1:-200}
+BIN=${BIN:-build/spotify-dbus}
+MOCK=${MOCK:-build/mock-player}
+
+. "$(dirname "$0")/mock-env.sh"
+
+# Record a reply for each of the mock's tracks
+for i in 1 2 3; do
+    "$BIN" --confirm next
+    "$BIN" --libdbus track >/dev/null
+done
+
+printf "%-26s %12s %14s %16s\n" variant "startup (us)" "decode (us)" "metadata (us)"
+for variant in "$BIN" "$BIN-o2" "$BIN-o3" "$BIN-pgo"; do
+    if [ ! -x "$variant" ]; then
+        continue
+    fi
+    startup=$(measure "$variant" track)
+    decode=$("$variant" --replay "$TMP/capture" bench backend -n 20000 | awk '$1 == "vtable" { print $7 }')
+    metadata=$("$variant" --replay "$TMP/capture" bench metadata -n 2000 | awk '$1 == "latency" { print $6 }')
+    printf "%-26s %12s %14s %16s\n" "$variant" "$startup" "$decode" "$metadata"
+done
@@ -0,0 +1,93 @@
+/*
+ * Checks of the wire client's value parsers on truncated & misaligned replies: each case builds
+ * a marshalled value in a buffer holding exactly `end` bytes, so that an accepted array or dict
+ * reaching past it would be read out of bounds.
+ *
+ * usage: wire-test   (built & run by `make check`)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/wire.h"
+
+static int failures = 0;
+
+static void check(const char *name, int ok)
+{
+    if (ok) {
+        printf("ok   %s\n", name);
+    } else {
+        fprintf(stderr, "FAIL %s\n", name);
+        failures++;
+    }
+}
+
+static void put_u32(unsigned char *buf, size_t pos, uint32_t v)
+{
+    memcpy(buf + pos, &v, sizeof(v));
+}
+
+/**
+ * Copies `size` bytes into an allocation of exactly that size, as the end of the reply
+ */
+static WireValue make_value(const unsigned char *data, size_t size, const char *sig, unsigned char **copy)
+{
+    WireValue value;
+
+    *copy = malloc(size);
+    memcpy(*copy, data, size);
+    value.base = *copy;
+    value.pos = 0;
+    value.end = size;
+    value.swap = 0;
+    value.sig = sig;
+    return value;
+}
+
+int main(void)
+{
+    unsigned char buf[64], *copy;
+    WireValue value, element;
+    WireDict dict;
+    const char *key;
+
+    // at: 8-byte elements start at offset 8, past the 4 bytes of the length
+    memset(buf, 0, sizeof(buf));
+    put_u32(buf, 0, 8);
+    value = make_value(buf, 4, "at", &copy);
+    check("array truncated after its length", !wire_value_first_element(&value, &element));
+    free(copy);
+
+    value = make_value(buf, 16, "at", &copy);
+    check("array complete", wire_value_first_element(&value, &element) && element.pos == 8 && element.end == 16);
+    free(copy);
+
+    // a{sv}: same, with dict entries aligned to 8
+    put_u32(buf, 0, 16);
+    value = make_value(buf, 4, "a{sv}", &copy);
+    check("dict truncated after its length", !wire_dict_begin(&value, &dict));
+    free(copy);
+
+    // a{sv} whose only entry holds an `at` ending right after its length: the elements would
+    // start at 32, past the end (28)
+    memset(buf, 0, sizeof(buf));
+    put_u32(buf, 0, 20);
+    put_u32(buf, 8, 4);
+    memcpy(buf + 12, "keys", 5);
+    memcpy(buf + 17, "\2at", 4);
+    put_u32(buf, 24, 8);
+    value = make_value(buf, 28, "a{sv}", &copy);
+    check("variant array truncated after its length",
+          wire_dict_begin(&value, &dict) && !wire_dict_next(&dict, &key, &element));
+    free(copy);
+
+    // Same entry with its 8 bytes of elements: accepted
+    put_u32(buf, 0, 32);
+    value = make_value(buf, 40, "a{sv}", &copy);
+    check("variant array complete", wire_dict_begin(&value, &dict) && wire_dict_next(&dict, &key, &element)
+          && strcmp(key, "keys") == 0 && wire_value_type(&element) == 'a' && !wire_dict_next(&dict, &key, &element));
+    free(copy);
+
+    return failures != 0;
+}